@@ -0,0 +1,177 @@
+#!/usr/bin/env python3
+"""Generates parameterised sat-lang programs for benchmarking.
+
+usage: gen_workload.py <sudoku|queens|pigeonhole|coloring|chain|parity|queens-card|pigeonhole-card|parity-xor> <size> [seed]
+
+sudoku      N x N board in the style of test/sudoku.sl: a few givens and the row, column and cell checks as loops
+queens      N queens on an N x N board, every constraint spelled out with constant indices
+pigeonhole  N + 1 pigeons in N holes, unsatisfiable
+coloring    random graph with N vertices and 2N edges coloured with 3 colours, edges are picked from seed
+chain       N if blocks nested inside each other, each binding a local variable read by the next level
+parity      N random equations over N bits, each the XOR of 8 bits, satisfied by a solution picked from seed
+
+The -card variants state the same constraints with exactly_one and at_most instead of pairwise checks, parity-xor
+uses ^ instead of spelling every XOR out with && and ||.
+
+Loops are the disjunction of their iterations, so constraints that have to hold for every index are unrolled into
+sequences of if blocks with constant indices instead.
+"""
+
+import random
+import sys
+
+
+def sudoku(n, seed):
+    rng = random.Random(seed)
+    lines = ["grid board[%d][%d][%d]" % (n, n, n), "", "function is_sat {"]
+    for _ in range(n // 3 + 1):
+        given = (rng.randrange(n), rng.randrange(n), rng.randrange(n))
+        lines.append("  if !board[%d][%d][%d] { return false }" % given)
+    lines += [
+        "",
+        "  for m in %d {" % n,
+        "    for n in %d {" % n,
+        "      for i in %d {" % n,
+        "        if board[0][m][n] && board[i][m][n] {",
+        "          return false",
+        "        }",
+        "        if board[m][0][n] && board[m][i][n] {",
+        "          return false",
+        "        }",
+        "        if board[m][n][0] && board[m][n][i] {",
+        "          return false",
+        "        }",
+        "      }",
+        "    }",
+        "  }",
+        "",
+        "  return true",
+        "}",
+    ]
+    return lines
+
+
+# expressions have no parentheses, so "none of cells" is written as a conjunction of negations
+def at_least_one(cells):
+    return "  if %s { return false }" % " && ".join("!" + cell for cell in cells)
+
+
+def at_most_one(cells):
+    return ["  if %s && %s { return false }" % (a, b) for i, a in enumerate(cells) for b in cells[i + 1:]]
+
+
+def native_exactly_one(cells):
+    return "  if !exactly_one(%s) { return false }" % ", ".join(cells)
+
+
+def native_at_most_one(cells):
+    return ["  if !at_most(1, %s) { return false }" % ", ".join(cells)]
+
+
+def queens(n, seed, native=False):
+    lines = ["grid queen[%d][%d]" % (n, n), "", "function is_sat {"]
+    if native:
+        lines += [native_exactly_one(["queen[%d][]" % r]) for r in range(n)]
+    else:
+        lines += [at_least_one(["queen[%d][%d]" % (r, c) for c in range(n)]) for r in range(n)]
+        for r in range(n):
+            lines += at_most_one(["queen[%d][%d]" % (r, c) for c in range(n)])
+    amo = native_at_most_one if native else at_most_one
+    for c in range(n):
+        lines += amo(["queen[][%d]" % c] if native else ["queen[%d][%d]" % (r, c) for r in range(n)])
+    for d in range(-n + 2, n - 1):
+        lines += amo(["queen[%d][%d]" % (r, r - d) for r in range(n) if 0 <= r - d < n])
+    for s in range(1, 2 * n - 2):
+        lines += amo(["queen[%d][%d]" % (r, s - r) for r in range(n) if 0 <= s - r < n])
+    return lines + ["  return true", "}"]
+
+
+def pigeonhole(n, seed, native=False):
+    lines = ["grid hole[%d][%d]" % (n + 1, n), "", "function is_sat {"]
+    if native:
+        lines += ["  if !at_least(1, hole[%d][]) { return false }" % p for p in range(n + 1)]
+        lines += ["  if !at_most(1, hole[][%d]) { return false }" % h for h in range(n)]
+        return lines + ["  return true", "}"]
+    lines += [at_least_one(["hole[%d][%d]" % (p, h) for h in range(n)]) for p in range(n + 1)]
+    for h in range(n):
+        lines += at_most_one(["hole[%d][%d]" % (p, h) for p in range(n + 1)])
+    return lines + ["  return true", "}"]
+
+
+def coloring(n, seed):
+    rng = random.Random(seed)
+    colors = 3
+    edges = set()
+    while len(edges) < min(2 * n, n * (n - 1) // 2):
+        u, v = rng.randrange(n), rng.randrange(n)
+        if u != v:
+            edges.add((min(u, v), max(u, v)))
+    lines = ["grid color[%d][%d]" % (n, colors), "", "function is_sat {"]
+    lines += [at_least_one(["color[%d][%d]" % (v, c) for c in range(colors)]) for v in range(n)]
+    for u, v in sorted(edges):
+        for c in range(colors):
+            lines.append("  if color[%d][%d] && color[%d][%d] { return false }" % (u, c, v, c))
+    return lines + ["  return true", "}"]
+
+
+def chain(n, seed):
+    lines = ["grid g[%d]" % (n + 1), "", "function is_sat {", "  v0 = g[0]"]
+    for k in range(1, n + 1):
+        indent = "  " * k
+        lines.append("%sif g[%d] || v%d {" % (indent, k, k - 1))
+        lines.append("%s  v%d = g[%d] && !v%d" % (indent, k, k, k - 1))
+    lines.append("%s  return v%d" % ("  " * n, n))
+    for k in range(n, 0, -1):
+        lines.append("%s}" % ("  " * k))
+    return lines + ["  return !v0", "}"]
+
+
+def parity(n, seed, native=False):
+    rng = random.Random(seed)
+    width = min(8, n)
+    solution = [rng.randrange(2) for _ in range(n)]
+    lines = ["grid bit[%d]" % n, "", "function is_sat {"]
+    for e in range(n):
+        bits = rng.sample(range(n), width)
+        if native:
+            lines.append("  e%d = %s" % (e, " ^ ".join("bit[%d]" % b for b in bits)))
+        else:
+            # there are no parentheses, so every XOR goes through local variables
+            lines.append("  e%d_0 = bit[%d]" % (e, bits[0]))
+            for k, b in enumerate(bits[1:], 1):
+                lines.append("  a%d_%d = e%d_%d && !bit[%d]" % (e, k, e, k - 1, b))
+                lines.append("  b%d_%d = !e%d_%d && bit[%d]" % (e, k, e, k - 1, b))
+                lines.append("  e%d_%d = a%d_%d || b%d_%d" % (e, k, e, k, e, k))
+            lines.append("  e%d = e%d_%d" % (e, e, width - 1))
+        odd = sum(solution[b] for b in bits) % 2
+        lines.append("  if %se%d { return false }" % ("!" if odd else "", e))
+    return lines + ["  return true", "}"]
+
+
+WORKLOADS = {
+    "sudoku": sudoku,
+    "queens": queens,
+    "pigeonhole": pigeonhole,
+    "coloring": coloring,
+    "chain": chain,
+    "parity": parity,
+    "queens-card": lambda n, seed: queens(n, seed, native=True),
+    "pigeonhole-card": lambda n, seed: pigeonhole(n, seed, native=True),
+    "parity-xor": lambda n, seed: parity(n, seed, native=True),
+}
+
+
+def generate(kind, size, seed=0):
+    return "\n".join(WORKLOADS[kind](size, seed)) + "\n"
+
+
+def main():
+    if len(sys.argv) < 3 or sys.argv[1] not in WORKLOADS:
+        sys.stderr.write("usage: gen_workload.py <%s> <size> [seed]\n" % "|".join(WORKLOADS))
+        return 1
+    sys.stdout.write(generate(sys.argv[1], int(sys.argv[2]), int(sys.argv[3]) if len(sys.argv) > 3 else 0))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,82 @@
+// Lexer throughput benchmark: lexes the given source repeated up to a fixed size with every lexer mode the CPU
+// supports, checks that each mode produces exactly the tokens of the scalar lexer and reports MB/s.
+//
+// usage: lexer-bench <file.sl> [megabytes]
+// Build with BUILD_TYPE=Release for meaningful numbers.
+
+#include "general.hpp"
+#include "parser.hpp"
+
+#include <chrono>
+#include <vector>
+
+bool same_tokens(const std::vector<slang::LexedToken> &a, const std::vector<slang::LexedToken> &b) {
+  if (a.size() != b.size()) return false;
+  for (usize i = 0; i < a.size(); ++i) {
+    if (a[i].kind != b[i].kind || a[i].line != b[i].line || a[i].value.index != b[i].value.index ||
+        a[i].value.length != b[i].value.length || a[i].intlit != b[i].intlit) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    error("usage: lexer-bench <file.sl> [megabytes]\n");
+    return err;
+  }
+  usize target_size = (usize)(argc > 2 ? atoi(argv[2]) : 64) << 20;
+
+  FILE *fstream = fopen(argv[1], "rb");
+  if (!fstream) {
+    error("could not open file %s\n", argv[1]);
+    return err;
+  }
+  std::vector<char> source;
+  char buffer[4096];
+  for (usize n; (n = fread(buffer, 1, sizeof(buffer), fstream)) > 0;) source.insert(source.end(), buffer, buffer + n);
+  fclose(fstream);
+  if (source.empty()) {
+    error("file %s is empty\n", argv[1]);
+    return err;
+  }
+
+  // the copies are separated by a newline so tokens never run into each other
+  source.push_back('\n');
+  std::vector<char> data;
+  while (data.size() < target_size) data.insert(data.end(), source.begin(), source.end());
+  if (data.size() > INT32_MAX) {
+    error("benchmark input must be smaller than 2GB\n");
+    return err;
+  }
+
+  std::vector<slang::LexedToken> expected;
+  std::vector<slang::LexedToken> tokens;
+  slang::LexerMode::Enum best = slang::detect_lexer_mode();
+  for (i32 mode = slang::LexerMode::Scalar; mode <= best; ++mode) {
+    slang::set_lexer_mode((slang::LexerMode::Enum)mode);
+
+    tokens.clear();
+    if (slang::lex(data.data(), (i32)data.size(), &tokens)) return err;
+
+    // best of three runs that only lex, so storing the tokens is not part of the measurement
+    double best_seconds = 0;
+    for (i32 run = 0; run < 3; ++run) {
+      auto start = std::chrono::steady_clock::now();
+      if (slang::lex(data.data(), (i32)data.size(), nullptr)) return err;
+      double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      if (run == 0 || seconds < best_seconds) best_seconds = seconds;
+    }
+
+    if (mode == slang::LexerMode::Scalar) {
+      expected.swap(tokens);
+    } else if (!same_tokens(expected, tokens)) {
+      error("%s lexer produced different tokens than the scalar lexer\n", slang::LexerMode::to_string[mode]);
+      return err;
+    }
+    printf("%-6s %8.1f MB/s  %zu tokens\n", slang::LexerMode::to_string[mode], (double)data.size() / 1e6 / best_seconds,
+           expected.size());
+  }
+  return ok;
+}
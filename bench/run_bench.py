@@ -0,0 +1,143 @@
+#!/usr/bin/env python3
+"""Runs sat-lang on generated workloads of growing size and records wall time and peak RSS of every run.
+
+usage: run_bench.py <sat-lang binary> <output directory> [--quick] [--timeout seconds] [-- extra sat-lang arguments]
+Needs Python 3.9 or later.
+
+The programs are written to <output directory>/programs and the results to <output directory>/results.csv, one row
+per workload and size. A run that crashes, fails or times out still gets its row, with the reason in the status
+column, and a timeout skips the larger sizes of that workload. Build the binary with BUILD_TYPE=Release for meaningful numbers. Every run passes
+--stats json, the time of each phase and the counters it reports are added as columns.
+
+Peak RSS is the ru_maxrss of the child, which Linux carries over from the process that was forked before the exec,
+so it never drops below the size of this script's interpreter (around 10 MiB). Programs are generated in a separate
+process to keep that floor constant.
+"""
+
+import csv
+import json
+import os
+import signal
+import subprocess
+import sys
+import time
+
+GENERATOR = os.path.join(os.path.dirname(os.path.abspath(__file__)), "gen_workload.py")
+
+PHASES = ["read", "parse", "cfg", "generate_sat", "dump", "to_cnf", "preprocess", "solve", "output_dimacs"]
+COUNTERS = ["tokens", "basic_blocks", "reachable_blocks", "sat_nodes", "table_hits", "table_misses",
+            "auxiliary_variables", "clauses", "duplicate_clauses"]
+
+SIZES = {
+    "sudoku": [9, 16, 25, 36, 49],
+    "queens": [8, 16, 24, 32, 48],
+    "pigeonhole": [6, 10, 14, 18, 24],
+    "coloring": [50, 100, 200, 400, 800],
+    "chain": [50, 100, 200, 400, 800],
+    "parity": [50, 100, 200, 400, 800],
+    "queens-card": [8, 12, 16, 24, 32],
+    "pigeonhole-card": [6, 10, 14, 18, 24],
+    "parity-xor": [50, 100, 200, 400, 800],
+}
+QUICK_SIZES = {kind: sizes[:2] for kind, sizes in SIZES.items()}
+
+
+def run(binary, program, workdir, extra_args, timeout, stats_path):
+    """Returns (exit code, wall seconds, peak RSS in KiB), the exit code is None when the run timed out"""
+    start = time.perf_counter()
+    with open(os.devnull, "wb") as devnull, open(stats_path, "wb") as stats:
+        process = subprocess.Popen([binary, "--stats", "json"] + extra_args + [program], cwd=workdir, stdout=devnull,
+                                   stderr=stats)
+    deadline = start + timeout
+    while True:
+        pid, status, usage = os.wait4(process.pid, os.WNOHANG)
+        if pid:
+            # the child is reaped here, so tell Popen it is gone
+            process.returncode = os.waitstatus_to_exitcode(status)
+            return process.returncode, time.perf_counter() - start, usage.ru_maxrss
+        if time.perf_counter() > deadline:
+            process.kill()
+            _, _, usage = os.wait4(process.pid, 0)
+            process.returncode = -9
+            return None, time.perf_counter() - start, usage.ru_maxrss
+        time.sleep(0.002)
+
+
+def run_status(code):
+    """ok, timeout, the signal that killed the run or failed for any other exit code"""
+    if code is None:
+        return "timeout"
+    if code < 0:
+        return "crashed (%s)" % signal.Signals(-code).name
+    return "ok" if code == 0 else "failed"
+
+
+def read_stats(stats_path):
+    """The stats line is the last one on stderr, empty when the run did not get to print it"""
+    with open(stats_path) as f:
+        lines = [line for line in f if line.startswith("{")]
+    if not lines:
+        return {}
+    stats = json.loads(lines[-1])
+    row = {phase + "_ns": stats["phase_ns"][phase] for phase in PHASES}
+    row.update({counter: stats[counter] for counter in COUNTERS})
+    return row
+
+
+def main():
+    args = sys.argv[1:]
+    extra_args = []
+    if "--" in args:
+        extra_args = args[args.index("--") + 1:]
+        args = args[:args.index("--")]
+    sizes = SIZES
+    if "--quick" in args:
+        sizes = QUICK_SIZES
+        args.remove("--quick")
+    timeout = 300.0
+    if "--timeout" in args:
+        at = args.index("--timeout")
+        timeout = float(args[at + 1])
+        del args[at:at + 2]
+    if len(args) != 2:
+        sys.stderr.write(__doc__)
+        return 1
+    binary, out_dir = os.path.abspath(args[0]), os.path.abspath(args[1])
+
+    program_dir = os.path.join(out_dir, "programs")
+    os.makedirs(program_dir, exist_ok=True)
+    results_path = os.path.join(out_dir, "results.csv")
+    with open(results_path, "w", newline="") as results:
+        writer = csv.writer(results)
+        stat_columns = [phase + "_ns" for phase in PHASES] + COUNTERS
+        writer.writerow(["workload", "size", "source_bytes", "status", "exit_code", "wall_seconds", "peak_rss_kib",
+                         "dimacs_bytes"] + stat_columns)
+        print("%-11s %6s %12s %10s %12s %14s" % ("workload", "size", "source", "wall s", "peak RSS", "dimacs"))
+        for kind, kind_sizes in sizes.items():
+            for size in kind_sizes:
+                program = os.path.join(program_dir, "%s_%d.sl" % (kind, size))
+                with open(program, "w") as f:
+                    subprocess.run([sys.executable, GENERATOR, kind, str(size)], stdout=f, check=True)
+                dimacs = os.path.join(out_dir, "output.dimacs")
+                if os.path.exists(dimacs):
+                    os.remove(dimacs)
+
+                stats_path = os.path.join(out_dir, "stats.json")
+                code, seconds, rss = run(binary, program, out_dir, extra_args, timeout, stats_path)
+                dimacs_bytes = os.path.getsize(dimacs) if os.path.exists(dimacs) else 0
+                stats = read_stats(stats_path)
+                status = run_status(code)
+                writer.writerow([kind, size, os.path.getsize(program), status, "" if code is None else code,
+                                 "%.4f" % seconds, rss, dimacs_bytes] +
+                                [stats.get(column, "") for column in stat_columns])
+                results.flush()
+                print("%-11s %6d %12d %10.3f %9d KiB %14d%s" % (kind, size, os.path.getsize(program), seconds, rss,
+                                                              dimacs_bytes, "" if code == 0 else "  (%s)" % status))
+                if code is None:
+                    break
+    print("results written to %s" % results_path)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
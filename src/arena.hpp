@@ -0,0 +1,60 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include "general.hpp"
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace slang {
+
+// Bump allocator for the nodes of one type. Objects are constructed one after another in fixed size chunks so nodes
+// that are created together sit next to each other, and they never move. clear() destroys every object at once but
+// keeps the chunks, so the next compilation in the same process allocates from memory that is already mapped.
+template <typename T>
+class Pool {
+public:
+  Pool() = default;
+  Pool(const Pool &) = delete;
+  Pool &operator=(const Pool &) = delete;
+
+  ~Pool() {
+    clear();
+    for (T *chunk : chunks) ::operator delete(chunk);
+  }
+
+  template <typename... Args>
+  T *make(Args &&...args) {
+    usize chunk = count / chunk_capacity;
+    if (chunk == chunks.size()) chunks.push_back(static_cast<T *>(::operator new(sizeof(T) * chunk_capacity)));
+    T *object = new (chunks[chunk] + count % chunk_capacity) T(std::forward<Args>(args)...);
+    ++count;
+    return object;
+  }
+
+  T &operator[](usize i) { return chunks[i / chunk_capacity][i % chunk_capacity]; }
+  const T &operator[](usize i) const { return chunks[i / chunk_capacity][i % chunk_capacity]; }
+
+  usize size() const { return count; }
+
+  void clear() {
+    if (!std::is_trivially_destructible<T>::value) {
+      for (usize i = 0; i < count; ++i) (*this)[i].~T();
+    }
+    count = 0;
+  }
+
+private:
+  static_assert(alignof(T) <= alignof(std::max_align_t), "chunks are only aligned for fundamental types");
+  static constexpr usize chunk_bytes    = 64 * 1024;
+  static constexpr usize chunk_capacity = sizeof(T) < chunk_bytes ? chunk_bytes / sizeof(T) : 1;
+
+  std::vector<T *> chunks;
+  usize count = 0;
+};
+
+} // namespace slang
+
+#endif
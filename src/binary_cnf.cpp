@@ -0,0 +1,279 @@
+#include "binary_cnf.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace slang {
+
+const usize header_length      = 64;
+const u32 default_index_stride = 64;
+
+const usize flush_threshold = 1 << 20;
+
+// A zigzag encoded difference of two i32 literals needs up to 33 bits, which is 5 bytes of 7 bits
+const usize max_literal_length = 5;
+const usize max_count_length   = 10;
+
+void put_u32(u8 *out, u32 value) {
+  for (usize i = 0; i < 4; ++i) out[i] = (u8)(value >> (8 * i));
+}
+
+void put_u64(u8 *out, u64 value) {
+  for (usize i = 0; i < 8; ++i) out[i] = (u8)(value >> (8 * i));
+}
+
+u32 get_u32(const u8 *in) {
+  u32 value = 0;
+  for (usize i = 0; i < 4; ++i) value |= (u32)in[i] << (8 * i);
+  return value;
+}
+
+u64 get_u64(const u8 *in) {
+  u64 value = 0;
+  for (usize i = 0; i < 8; ++i) value |= (u64)in[i] << (8 * i);
+  return value;
+}
+
+u8 *put_varint(u8 *out, u64 value) {
+  while (value >= 0x80) {
+    *out++ = (u8)(value | 0x80);
+    value >>= 7;
+  }
+  *out++ = (u8)value;
+  return out;
+}
+
+// Returns false if the varint runs past end or does not fit in 64 bits
+bool get_varint(const u8 **in, const u8 *end, u64 *out_value) {
+  u64 value = 0;
+  for (u32 shift = 0; shift < 64 && *in < end; shift += 7) {
+    u8 byte = *(*in)++;
+    value |= (u64)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      *out_value = value;
+      return true;
+    }
+  }
+  return false;
+}
+
+u64 zigzag(i64 value) { return ((u64)value << 1) ^ (u64)(value >> 63); }
+
+i64 unzigzag(u64 value) { return (i64)(value >> 1) ^ -(i64)(value & 1); }
+
+Result flush(BinaryCnfWriter *writer) {
+  if (fwrite(writer->buffer.data(), 1, writer->buffer_length, writer->file) != writer->buffer_length) {
+    error("failed to write binary cnf output\n");
+    return err;
+  }
+  writer->file_offset += writer->buffer_length;
+  writer->buffer_length = 0;
+  return ok;
+}
+
+BinaryCnfWriter::~BinaryCnfWriter() {
+  if (file) fclose(file);
+}
+
+Result BinaryCnfWriter::open(cstr filepath) {
+  file = fopen(filepath, "wb");
+  if (!file) {
+    error("could not open file for writing: %s\n", filepath);
+    return err;
+  }
+  buffer.resize(flush_threshold + max_literal_length * 64);
+
+  // Reserve the header, it is written once the counts and the position of the index are known
+  memset(buffer.data(), 0, header_length);
+  buffer_length = header_length;
+  return ok;
+}
+
+void BinaryCnfWriter::add_clause(const int *literals, usize count) {
+  usize max_length = max_count_length + count * max_literal_length;
+  if (buffer.size() - buffer_length < max_length) {
+    if (flush(this)) panic("could not write clause to binary cnf output\n");
+    if (buffer.size() < max_length) buffer.resize(max_length);
+  }
+  if (clause_count % default_index_stride == 0) index.push_back(file_offset + buffer_length);
+
+  u8 *out      = put_varint(buffer.data() + buffer_length, count);
+  i64 previous = 0;
+  for (usize i = 0; i < count; ++i) {
+    i32 variable = literals[i] < 0 ? -literals[i] : literals[i];
+    assert(variable != 0); // 0 is not a valid variable
+    if (variable > max_variable) max_variable = variable;
+
+    out      = put_varint(out, zigzag((i64)literals[i] - previous));
+    previous = literals[i];
+  }
+  buffer_length = (usize)(out - buffer.data());
+  literal_count += count;
+  ++clause_count;
+
+  if (buffer_length >= flush_threshold && flush(this)) panic("could not write clause to binary cnf output\n");
+}
+
+Result BinaryCnfWriter::close() {
+  assert(file);
+  Result result    = flush(this);
+  u64 index_offset = file_offset;
+  for (usize i = 0; !result && i < index.size(); ++i) {
+    u8 entry[8];
+    put_u64(entry, index[i]);
+    if (fwrite(entry, 1, sizeof(entry), file) != sizeof(entry)) result = err;
+  }
+
+  u8 header[header_length] = {};
+  memcpy(header, binary_cnf_magic, sizeof(binary_cnf_magic));
+  put_u32(header + 8, binary_cnf_version);
+  put_u32(header + 12, default_index_stride);
+  put_u64(header + 16, (u64)max_variable);
+  put_u64(header + 24, clause_count);
+  put_u64(header + 32, literal_count);
+  put_u64(header + 40, index_offset);
+  put_u64(header + 48, index.size());
+
+  if (!result && (fseek(file, 0, SEEK_SET) || fwrite(header, 1, header_length, file) != header_length)) result = err;
+  if (result) error("failed to write binary cnf output\n");
+  if (fclose(file)) result = err;
+  file = nullptr;
+  return result;
+}
+
+Result output_binary_cnf(const ClauseDatabase &cnf, cstr filepath) {
+  BinaryCnfWriter writer;
+  if (writer.open(filepath)) return err;
+  for (usize i = 0; i < cnf.clause_count(); ++i) {
+    Clause clause = cnf.clause(i);
+    writer.add_clause(clause.begin(), clause.size());
+  }
+  // variables that no longer occur in any clause still count, so models keep their size
+  if (cnf.max_variable > writer.max_variable) writer.max_variable = cnf.max_variable;
+  return writer.close();
+}
+
+BinaryCnf::~BinaryCnf() { close(); }
+
+Result BinaryCnf::open(cstr filepath) {
+  close();
+  int fd = ::open(filepath, O_RDONLY);
+  if (fd < 0) {
+    error("could not open file %s\n", filepath);
+    return err;
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) || file_stat.st_size < (off_t)header_length) {
+    error("%s is not a binary cnf file\n", filepath);
+    ::close(fd);
+    return err;
+  }
+  void *mapping = mmap(nullptr, (usize)file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (mapping == MAP_FAILED) {
+    error("could not map file %s\n", filepath);
+    return err;
+  }
+  data   = (const u8 *)mapping;
+  length = (usize)file_stat.st_size;
+
+  u64 variable_count = get_u64(data + 16);
+  u64 index_offset   = get_u64(data + 40);
+  clause_count       = get_u64(data + 24);
+  literal_count      = get_u64(data + 32);
+  index_stride       = get_u32(data + 12);
+  index_entries      = get_u64(data + 48);
+  if (memcmp(data, binary_cnf_magic, sizeof(binary_cnf_magic)) || get_u32(data + 8) != binary_cnf_version) {
+    error("%s is not a binary cnf file of version %u\n", filepath, binary_cnf_version);
+    close();
+    return err;
+  }
+  // every clause and every literal takes at least one byte, which also bounds what load reserves
+  if (variable_count > INT32_MAX || clause_count > length || literal_count > length || index_stride == 0 ||
+      index_offset < header_length || index_offset > length ||
+      index_entries != (clause_count + index_stride - 1) / index_stride ||
+      index_entries > (length - index_offset) / 8) {
+    error("corrupt header in binary cnf file %s\n", filepath);
+    close();
+    return err;
+  }
+  max_variable = (i32)variable_count;
+  index        = data + index_offset;
+  madvise(mapping, length, MADV_SEQUENTIAL);
+  return ok;
+}
+
+void BinaryCnf::close() {
+  if (data) munmap((void *)data, length);
+  data   = nullptr;
+  length = 0;
+  index  = nullptr;
+}
+
+// Decodes the clause at *in and passes every literal to push, returns false if the clause is corrupt
+template <class Push>
+bool decode_clause(const u8 **in, const u8 *end, i32 max_variable, Push push) {
+  u64 count;
+  if (!get_varint(in, end, &count)) return false;
+  i64 literal = 0;
+  for (u64 i = 0; i < count; ++i) {
+    u64 delta;
+    if (!get_varint(in, end, &delta) || delta > zigzag(2 * (i64)INT32_MAX)) return false;
+    literal += unzigzag(delta);
+    if (literal == 0 || literal > max_variable || literal < -(i64)max_variable) return false;
+    push((int)literal);
+  }
+  return true;
+}
+
+Result BinaryCnf::clause(u64 clause_index, std::vector<int> *out_literals) const {
+  assert(clause_index < clause_count);
+  out_literals->clear();
+  u64 offset    = get_u64(index + 8 * (clause_index / index_stride));
+  const u8 *end = index;
+  const u8 *in  = data + (offset < (u64)(end - data) ? offset : (u64)(end - data));
+
+  // clauses before the requested one only have their varints skipped, which needs no decoding
+  for (u64 skip = clause_index % index_stride; skip > 0; --skip) {
+    u64 count;
+    if (!get_varint(&in, end, &count)) break;
+    for (; count > 0 && in < end; ++in) count -= !(*in & 0x80);
+  }
+  if (!decode_clause(&in, end, max_variable, [out_literals](int literal) { out_literals->push_back(literal); })) {
+    error("corrupt clause %llu in binary cnf\n", (unsigned long long)clause_index);
+    return err;
+  }
+  return ok;
+}
+
+Result BinaryCnf::load(ClauseDatabase *out_cnf) const {
+  out_cnf->literals.clear();
+  out_cnf->offsets.assign(1, 0);
+  out_cnf->reserve((usize)clause_count, (usize)literal_count);
+
+  const u8 *in  = data + header_length;
+  const u8 *end = index;
+  for (u64 i = 0; i < clause_count; ++i) {
+    if (!decode_clause(&in, end, max_variable, [out_cnf](int literal) { out_cnf->literals.push_back(literal); })) {
+      error("corrupt clause %llu in binary cnf\n", (unsigned long long)i);
+      return err;
+    }
+    out_cnf->end_clause();
+  }
+  out_cnf->max_variable = max_variable;
+  return ok;
+}
+
+bool is_binary_cnf(cstr filepath) {
+  FILE *file = fopen(filepath, "rb");
+  if (!file) return false;
+  char magic[sizeof(binary_cnf_magic)];
+  bool matches = fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+                 !memcmp(magic, binary_cnf_magic, sizeof(binary_cnf_magic));
+  fclose(file);
+  return matches;
+}
+
+} // namespace slang
@@ -0,0 +1,91 @@
+#ifndef BINARY_CNF_HPP
+#define BINARY_CNF_HPP
+
+#include "clause_database.hpp"
+#include "general.hpp"
+#include <vector>
+
+namespace slang {
+
+// clang-format off
+#define CNF_FORMAT(pick) \
+  pick(Dimacs, "dimacs"), \
+  pick(Binary, "binary"),
+DECLARE_KIND(CNF_FORMAT, CnfFormat);
+// clang-format on
+
+// Binary CNF container, every integer is little endian.
+//
+//   0  magic "SLCNF\r\n\x1a"
+//   8  u32 version, u32 index stride
+//  16  u64 variable count, u64 clause count, u64 literal count
+//  40  u64 file offset of the index, u64 index entry count, u64 reserved
+//  64  clauses
+//
+// A clause is its literal count as a varint followed by every literal as the zigzag varint of its difference to the
+// literal before it, the first literal is relative to 0. Literals keep their order so converting back to DIMACS gives
+// the same clauses. The index holds the u64 file offset of every stride-th clause, so any clause is found by
+// decoding less than a stride of clauses.
+const char binary_cnf_magic[8] = {'S', 'L', 'C', 'N', 'F', '\r', '\n', '\x1a'};
+const u32 binary_cnf_version   = 1;
+
+// Writes clauses into the binary container as they arrive. Like DimacsWriter the header is patched in close(), so
+// the output has to be seekable.
+struct BinaryCnfWriter : ClauseSink {
+  FILE *file = nullptr;
+  std::vector<u8> buffer;
+  usize buffer_length = 0;
+  u64 file_offset     = 0; // of the end of buffer
+  std::vector<u64> index;
+
+  i32 max_variable  = 0;
+  u64 clause_count  = 0;
+  u64 literal_count = 0;
+
+  ~BinaryCnfWriter() override;
+
+  Result open(cstr filepath);
+
+  using ClauseSink::add_clause;
+  void add_clause(const int *literals, usize count) override;
+
+  Result close();
+};
+
+Result output_binary_cnf(const ClauseDatabase &cnf, cstr filepath);
+
+// Read-only mapping of a binary CNF file. Clauses are decoded straight out of the mapping, either one at a time
+// through the index or all at once into a ClauseDatabase.
+struct BinaryCnf {
+  const u8 *data = nullptr;
+  usize length   = 0;
+
+  i32 max_variable  = 0;
+  u64 clause_count  = 0;
+  u64 literal_count = 0;
+  u32 index_stride  = 0;
+  const u8 *index   = nullptr;
+  u64 index_entries = 0;
+
+  BinaryCnf() = default;
+  BinaryCnf(const BinaryCnf &) = delete;
+  BinaryCnf &operator=(const BinaryCnf &) = delete;
+  ~BinaryCnf();
+
+  // Maps the file and checks the header and the index
+  Result open(cstr filepath);
+  void close();
+
+  // Decodes clause clause_index into out_literals
+  Result clause(u64 clause_index, std::vector<int> *out_literals) const;
+
+  // Decodes every clause into out_cnf, which is cleared first
+  Result load(ClauseDatabase *out_cnf) const;
+};
+
+// True if the file starts with the binary CNF magic
+bool is_binary_cnf(cstr filepath);
+
+} // namespace slang
+
+#endif
@@ -0,0 +1,167 @@
+#include "cardinality.hpp"
+
+#include <algorithm>
+
+namespace slang {
+
+// Larger costs are all the same, binomial gets there quickly and is never the cheapest encoding by then
+const u64 cost_limit = u64(1) << 48;
+
+u64 binomial_clauses(i32 count, i32 bound) {
+  // C(count, bound + 1), every intermediate C(count - bound - 1 + i, i) is exact
+  u64 clauses = 1;
+  i32 chosen  = bound + 1;
+  for (i32 i = 1; i <= chosen; ++i) {
+    clauses = clauses * (u64)(count - chosen + i) / (u64)i;
+    if (clauses >= cost_limit) return cost_limit;
+  }
+  return clauses;
+}
+
+// Counter variables of literal i, which count the first i + 1 literals up to bound
+i32 counter_width(i32 i, i32 bound) { return std::min(i + 1, bound); }
+
+AtMostEncoding counter_cost(i32 count, i32 bound) {
+  AtMostEncoding cost = {CardinalityEncoding::Counter, 0, 0};
+  for (i32 i = 0; i < count - 1; ++i) {
+    i32 width     = counter_width(i, bound);
+    i32 previous  = i > 0 ? counter_width(i - 1, bound) : 0;
+    cost.clauses += 1 + (u64)previous + (u64)(width - 1) + (previous == bound ? 1 : 0);
+    cost.auxiliary_variables += width;
+  }
+  cost.clauses += 1;
+  return cost;
+}
+
+// Pairs of counts a of one child and b of the other with a <= left, b <= right and first <= a + b <= last
+u64 count_pairs(i32 left, i32 right, i32 first, i32 last) {
+  u64 pairs = 0;
+  for (i32 sum = first; sum <= last; ++sum) {
+    i32 low  = std::max(0, sum - right);
+    i32 high = std::min(left, sum);
+    if (high >= low) pairs += (u64)(high - low + 1);
+  }
+  return pairs;
+}
+
+// Adds the cost of the totalizer node over size literals to cost and returns the number of its outputs
+i32 totalizer_node_cost(i32 size, i32 bound, bool is_root, AtMostEncoding *cost) {
+  if (size == 1) return 1;
+  i32 left_outputs  = totalizer_node_cost(size / 2, bound, false, cost);
+  i32 right_outputs = totalizer_node_cost(size - size / 2, bound, false, cost);
+  if (is_root) {
+    cost->clauses += count_pairs(left_outputs, right_outputs, bound + 1, bound + 1);
+    return 0;
+  }
+  i32 outputs = std::min(size, bound + 1);
+  cost->clauses += count_pairs(left_outputs, right_outputs, 1, outputs);
+  cost->auxiliary_variables += outputs;
+  return outputs;
+}
+
+AtMostEncoding choose_at_most_encoding(i32 count, i32 bound) {
+  assert(bound >= 0 && bound < count);
+  AtMostEncoding best = {CardinalityEncoding::Binomial, binomial_clauses(count, bound), 0};
+  if (bound == 0 || count < 2) return best;
+
+  AtMostEncoding totalizer = {CardinalityEncoding::Totalizer, 0, 0};
+  totalizer_node_cost(count, bound, true, &totalizer);
+  for (const AtMostEncoding &candidate : {counter_cost(count, bound), totalizer}) {
+    if (candidate.clauses + (u64)candidate.auxiliary_variables < best.clauses + (u64)best.auxiliary_variables) {
+      best = candidate;
+    }
+  }
+  return best;
+}
+
+void emit_binomial(const int *literals, i32 count, i32 bound, int guard, std::vector<int> &clause, ClauseSink *cnf) {
+  // chosen holds the indices of the next set in lexicographic order
+  std::vector<i32> chosen((u32)bound + 1);
+  for (i32 i = 0; i <= bound; ++i) chosen[(u32)i] = i;
+  for (;;) {
+    clause.clear();
+    clause.push_back(guard);
+    for (i32 i : chosen) clause.push_back(-literals[i]);
+    cnf->add_clause(clause.data(), clause.size());
+
+    i32 position = bound;
+    while (position >= 0 && chosen[(u32)position] == count - 1 - (bound - position)) --position;
+    if (position < 0) return;
+    ++chosen[(u32)position];
+    for (i32 i = position + 1; i <= bound; ++i) chosen[(u32)i] = chosen[(u32)i - 1] + 1;
+  }
+}
+
+// Counter variable j of literal i is true when more than j of the first i + 1 literals are
+void emit_counter(const int *literals, i32 count, i32 bound, int guard, int first_auxiliary, ClauseSink *cnf) {
+  int previous_first = 0;
+  i32 previous       = 0;
+  int next           = first_auxiliary;
+  for (i32 i = 0; i < count; ++i) {
+    int x = literals[i];
+    // the last literal only has to check for an overflow
+    if (previous == bound) cnf->add_clause({guard, -x, -(previous_first + bound - 1)});
+    if (i == count - 1) break;
+
+    int current = next;
+    i32 width   = counter_width(i, bound);
+    next += width;
+    cnf->add_clause({-x, current});
+    for (i32 j = 0; j < previous; ++j) cnf->add_clause({-(previous_first + j), current + j});
+    for (i32 j = 1; j < width; ++j) cnf->add_clause({-x, -(previous_first + j - 1), current + j});
+    previous_first = current;
+    previous       = width;
+  }
+  assert(next - first_auxiliary == counter_cost(count, bound).auxiliary_variables);
+}
+
+// Unary count of the size literals, outputs[j] is true when more than j of them are. Only the root, which has no
+// outputs, passes guard and adds the clauses that forbid a count above bound.
+void emit_totalizer_node(const int *literals, i32 size, i32 bound, int guard, int *next_auxiliary,
+                         std::vector<int> *outputs, ClauseSink *cnf) {
+  outputs->clear();
+  if (size == 1) {
+    outputs->push_back(literals[0]);
+    return;
+  }
+  std::vector<int> left, right;
+  emit_totalizer_node(literals, size / 2, bound, 0, next_auxiliary, &left, cnf);
+  emit_totalizer_node(literals + size / 2, size - size / 2, bound, 0, next_auxiliary, &right, cnf);
+
+  bool is_root    = guard != 0;
+  i32 first_sum   = is_root ? bound + 1 : 1;
+  i32 output_size = is_root ? 0 : std::min(size, bound + 1);
+  for (i32 i = 0; i < output_size; ++i) outputs->push_back((*next_auxiliary)++);
+  i32 last_sum = is_root ? bound + 1 : output_size;
+
+  std::vector<int> clause;
+  for (i32 a = 0; a <= (i32)left.size(); ++a) {
+    for (i32 b = std::max(0, first_sum - a); b <= (i32)right.size() && a + b <= last_sum; ++b) {
+      clause.clear();
+      if (is_root) clause.push_back(guard);
+      if (a > 0) clause.push_back(-left[(u32)a - 1]);
+      if (b > 0) clause.push_back(-right[(u32)b - 1]);
+      if (!is_root) clause.push_back((*outputs)[(u32)(a + b) - 1]);
+      cnf->add_clause(clause.data(), clause.size());
+    }
+  }
+}
+
+void emit_at_most(const int *literals, i32 count, i32 bound, int guard, int first_auxiliary,
+                  const AtMostEncoding &encoding, std::vector<int> &clause, ClauseSink *cnf) {
+  assert(guard != 0 && bound >= 0 && bound < count);
+  switch (encoding.encoding) {
+  case CardinalityEncoding::Binomial: emit_binomial(literals, count, bound, guard, clause, cnf); break;
+  case CardinalityEncoding::Counter: emit_counter(literals, count, bound, guard, first_auxiliary, cnf); break;
+  case CardinalityEncoding::Totalizer: {
+    int next_auxiliary = first_auxiliary;
+    std::vector<int> outputs;
+    emit_totalizer_node(literals, count, bound, guard, &next_auxiliary, &outputs, cnf);
+    assert(next_auxiliary - first_auxiliary == encoding.auxiliary_variables);
+    break;
+  }
+  default: assert(!"Unreachable"); break;
+  }
+}
+
+} // namespace slang
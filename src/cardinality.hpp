@@ -0,0 +1,39 @@
+#ifndef CARDINALITY_HPP
+#define CARDINALITY_HPP
+
+#include "clause_database.hpp"
+#include "general.hpp"
+#include <vector>
+
+namespace slang {
+
+// clang-format off
+#define CARDINALITY_ENCODING(pick) \
+  pick(Binomial,  "binomial"), \
+  pick(Counter,   "counter"), \
+  pick(Totalizer, "totalizer"),
+DECLARE_KIND(CARDINALITY_ENCODING, CardinalityEncoding);
+// clang-format on
+
+// Binomial forbids every set of bound + 1 literals and needs no auxiliary variables. The sequential counter keeps a
+// unary count of the literals seen so far in bound variables per literal, the totalizer adds up unary counts in a
+// balanced tree. Counts never go above bound + 1 in either.
+struct AtMostEncoding {
+  CardinalityEncoding::Enum encoding;
+  u64 clauses;
+  i32 auxiliary_variables;
+};
+
+// The encoding of at most bound of count literals with the fewest clauses plus auxiliary variables, preferring the
+// earlier encoding on a tie. bound is at least 0 and below count.
+AtMostEncoding choose_at_most_encoding(i32 count, i32 bound);
+
+// Passes clauses to cnf that hold when guard is true or at most bound of literals are. The auxiliary variables of
+// encoding, which has to be the choice for count and bound, are numbered from first_auxiliary. They are only ever
+// forced true by the literals, so every assignment of at most bound true literals extends to the clauses.
+void emit_at_most(const int *literals, i32 count, i32 bound, int guard, int first_auxiliary,
+                  const AtMostEncoding &encoding, std::vector<int> &clause, ClauseSink *cnf);
+
+} // namespace slang
+
+#endif
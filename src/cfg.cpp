@@ -1,5 +1,10 @@
 #include "cfg.hpp"
 
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <unordered_map>
 #include <vector>
 
 namespace slang {
@@ -28,6 +33,14 @@ void dump_expression(Expression *expression) {
     dump_expression(expression->binary.right);
     printf(")");
     break;
+  case ExpressionKind::Xor:
+  case ExpressionKind::Xnor:
+    printf("(");
+    dump_expression(expression->binary.left);
+    printf(expression->kind == ExpressionKind::Xor ? " xor " : " == ");
+    dump_expression(expression->binary.right);
+    printf(")");
+    break;
   case ExpressionKind::GridRef: printf("g%d", expression->grid_start_variable); break;
   case ExpressionKind::Index:
     dump_expression(expression->index.inner);
@@ -37,6 +50,19 @@ void dump_expression(Expression *expression) {
       printf("[i%d]", expression->index.indexvar);
     }
     break;
+  case ExpressionKind::AtMost:
+  case ExpressionKind::AtLeast:
+  case ExpressionKind::Exactly:
+    printf("%s(%d", expression->kind == ExpressionKind::AtMost    ? "at_most"
+                    : expression->kind == ExpressionKind::AtLeast ? "at_least"
+                                                                  : "exactly",
+           expression->cardinality.bound);
+    for (Expression *list = expression->cardinality.operands; list; list = list->binary.right) {
+      printf(", ");
+      dump_expression(list->binary.left);
+    }
+    printf(")");
+    break;
   default: assert(!"TODO: unimplemented cfg dump expression straight"); break;
   }
 }
@@ -102,146 +128,975 @@ void dump_cfg(CFG *cfg) {
   printf("}\n");
 }
 
-struct IndexVariable {
-  i32 id;
+// Variables are resolved through flat arrays indexed by variable id. A block overwrites the entries it binds and
+// restores them when it is done, the saved entries are kept in SavedLocal/SavedIndex stacks. block_depth records
+// which block bound the entry: the first assignment in a block is the one its uses see, and an index variable that
+// already counted in the block keeps counting from where its earlier loop stopped.
+struct LocalBinding {
+  Expression *value;
+  i32 block_depth;
+};
+
+struct IndexBinding {
+  // true while the body of the variable's loop is compiled, the value is then the loop counter of the iteration the
+  // template is run for
+  bool is_counter;
   i32 value;
+  i32 block_depth;
+};
+
+struct SavedLocal {
+  i32 id;
+  LocalBinding binding;
+};
+
+struct SavedIndex {
+  i32 id;
+  IndexBinding binding;
+};
+
+struct JoinKeyHash {
+  usize operator()(const std::vector<i64> &key) const {
+    usize hash = key.size();
+    for (i64 value : key) hash = hash * 0x100000001b3 ^ std::hash<i64>()(value);
+    return hash;
+  }
+};
+
+// A block with several predecessors is reached by every path through the branches before it, so it is compiled
+// once per distinct state of the variables it can observe and the paths share the resulting node
+struct BlockInfo {
+  i32 predecessor_count = 0;
+
+  // bitset of the local variables read by the block or any block reachable from it
+  bool reads_computed = false;
+  std::vector<u64> reads;
+};
+
+// clang-format off
+#define TEMPLATE_NODE_KIND(pick) \
+  pick(Const,   "Const"), \
+  pick(Literal, "Literal"), \
+  pick(Not,     "Not"), \
+  pick(And,     "And"), \
+  pick(Or,      "Or"), \
+  pick(Xor,     "Xor"), \
+  pick(Xnor,    "Xnor"), \
+  pick(AtMost,  "AtMost"), \
+  pick(AtLeast, "AtLeast"), \
+  pick(Loop,    "Loop"),
+DECLARE_KIND(TEMPLATE_NODE_KIND, TemplateNodeKind);
+// clang-format on
+
+struct AffineTerm {
+  i32 indexvar;
+  i32 coefficient;
+};
+
+// grid literal offset + sum(coefficient * counter) over terms[first_term .. first_term + term_count)
+struct LiteralNode {
+  i32 offset;
+  u32 first_term;
+  u32 term_count;
 };
 
-struct Scope {
-  Scope *parent;
-  std::vector<AssignInstruction> local_variable_context;
-  std::vector<IndexVariable> index_variable_context;
+// indices of earlier nodes in the same template, NOT only uses right
+struct OperandNodes {
+  i32 left;
+  i32 right;
 };
 
-SAT_Expression literal_1{1};
-SAT_Expression not_literal_1{Operator::NOT, nullptr, &literal_1};
-SAT_Expression false_sat{Operator::AND, &literal_1, &not_literal_1};
-SAT_Expression true_sat{Operator::OR, &literal_1, &not_literal_1};
+// at most or at least bound of the nodes operand_nodes[first_operand .. first_operand + operand_count)
+struct CardinalityNode {
+  i32 bound;
+  u32 first_operand;
+  u32 operand_count;
+};
+
+struct LoopNode {
+  i32 indexvar;
+  i32 start;
+  i32 iterations;
+  i32 body_template;
+};
+
+struct TemplateNode {
+  TemplateNodeKind::Enum kind;
+  union {
+    SAT_Expression *constant;
+    LiteralNode literal;
+    OperandNodes operands;
+    CardinalityNode cardinality;
+    LoopNode loop;
+  };
+};
+
+// A block compiled once with the counters of the loops around it left symbolic. Everything that does not depend on
+// a counter is folded into constants while compiling, grid references that do are affine in the counters. Nodes only
+// refer to earlier nodes, so running the template for an iteration is a single pass over nodes.
+struct SatTemplate {
+  std::vector<TemplateNode> nodes;
+  std::vector<AffineTerm> terms;
+  std::vector<i32> operand_nodes;
+  i32 root;
+
+  // compiled join blocks by block id and join_key
+  std::unordered_map<std::vector<i64>, i32, JoinKeyHash> joins;
+};
+
+struct Translator {
+  SAT_ExpressionTable *table;
+
+  i32 local_variable_count;
+  i32 index_variable_count;
+  std::vector<BlockInfo> blocks;
+
+  std::vector<SatTemplate> templates;
+  i32 current_template;
+
+  // bindings by variable id while compiling
+  std::vector<LocalBinding> locals;
+  std::vector<IndexBinding> indices;
+  std::vector<SavedLocal> saved_locals;
+  std::vector<SavedIndex> saved_indices;
+  i32 block_depth;
+
+  // changes whenever a binding or the current template does. The node a local variable's binding compiled to is
+  // reused while local_versions still holds the version it was compiled at.
+  u64 bindings_version;
+  std::vector<i32> local_nodes;
+  std::vector<u64> local_versions;
+};
 
-SAT_Expression *new_not(SAT_Expression *inner) {
-  if (inner == &false_sat) return &true_sat;
-  if (inner == &true_sat) return &false_sat;
-  return new SAT_Expression(Operator::NOT, nullptr, inner);
+// State of one thread running templates: the table nodes are made in, the loop counters by index variable id and
+// the value of every node by template
+struct TemplateRunner {
+  SAT_ExpressionTable *table;
+  std::vector<i32> counters;
+  std::vector<std::vector<SAT_Expression *>> values;
+  std::vector<SAT_Expression *> operands; // of the cardinality node being run
+};
+
+// Per worker state for running loop iterations in parallel. Workers make their nodes in an overlay of the shared
+// table, imported maps the id of an overlay node minus the overlay's first id to its copy in the shared table.
+struct LoopWorker {
+  std::unique_ptr<SAT_ExpressionTable> overlay;
+  TemplateRunner runner;
+  std::vector<SAT_Expression *> imported;
+};
+
+struct ParallelRun {
+  ThreadPool *pool;
+  std::vector<LoopWorker> workers;
+  // result of every iteration and the worker that ran it, for the loop being run in parallel
+  std::vector<SAT_Expression *> results;
+  std::vector<i32> result_workers;
+};
+
+SAT_Expression *new_not(SAT_ExpressionTable *table, SAT_Expression *inner) {
+  if (inner == table->falseExpression) return table->trueExpression;
+  if (inner == table->trueExpression) return table->falseExpression;
+  return table->node(Operator::NOT, nullptr, inner);
 }
 
-SAT_Expression *new_and(SAT_Expression *left, SAT_Expression *right) {
-  if (left == &false_sat || right == &false_sat) return &false_sat;
-  if (left == &true_sat) return right;
-  if (right == &true_sat) return left;
+SAT_Expression *new_and(SAT_ExpressionTable *table, SAT_Expression *left, SAT_Expression *right) {
+  if (left == table->falseExpression || right == table->falseExpression) return table->falseExpression;
+  if (left == table->trueExpression) return right;
+  if (right == table->trueExpression) return left;
   if (left == right) return left;
-  if (*left == *right) return left;
-  return new SAT_Expression(Operator::AND, left, right);
+  return table->node(Operator::AND, left, right);
 }
 
-SAT_Expression *new_or(SAT_Expression *left, SAT_Expression *right) {
-  if (left == &true_sat || right == &true_sat) return &true_sat;
-  if (left == &false_sat) return right;
-  if (right == &false_sat) return left;
+SAT_Expression *new_or(SAT_ExpressionTable *table, SAT_Expression *left, SAT_Expression *right) {
+  if (left == table->trueExpression || right == table->trueExpression) return table->trueExpression;
+  if (left == table->falseExpression) return right;
+  if (right == table->falseExpression) return left;
   if (left == right) return left;
-  return new SAT_Expression(Operator::OR, left, right);
+  return table->node(Operator::OR, left, right);
 }
 
-Expression *find_local_variable_value(Scope *scope, i32 variable_id) {
-  if (!scope) return nullptr;
-  for (auto lvar : scope->local_variable_context) {
-    if (lvar.localvar == variable_id) return lvar.right_value_expression;
-  }
-  return find_local_variable_value(scope->parent, variable_id);
+SAT_Expression *new_xor(SAT_ExpressionTable *table, SAT_Expression *left, SAT_Expression *right) {
+  if (left == table->falseExpression) return right;
+  if (right == table->falseExpression) return left;
+  if (left == table->trueExpression) return new_not(table, right);
+  if (right == table->trueExpression) return new_not(table, left);
+  if (left == right) return table->falseExpression;
+  return table->node(Operator::XOR, left, right);
 }
 
-i32 find_index_variable_value(Scope *scope, i32 variable_id, bool increment) {
-  if (!scope) return -1;
-  for (i32 i = 0; i < (i32)scope->index_variable_context.size(); ++i) {
-    auto ivar = scope->index_variable_context[(u32)i];
-    if (ivar.id == variable_id) {
-      i32 old_value = ivar.value;
-      if (increment) scope->index_variable_context[(u32)i].value++;
-      return old_value;
+SAT_Expression *new_xnor(SAT_ExpressionTable *table, SAT_Expression *left, SAT_Expression *right) {
+  if (left == table->trueExpression) return right;
+  if (right == table->trueExpression) return left;
+  if (left == table->falseExpression) return new_not(table, right);
+  if (right == table->falseExpression) return new_not(table, left);
+  if (left == right) return table->trueExpression;
+  return table->node(Operator::XNOR, left, right);
+}
+
+SAT_Expression *new_disjunction(SAT_ExpressionTable *table, const std::vector<SAT_Expression *> &operands) {
+  SAT_Expression *value = table->falseExpression;
+  for (SAT_Expression *operand : operands) value = new_or(table, value, operand);
+  return value;
+}
+
+SAT_Expression *new_conjunction(SAT_ExpressionTable *table, const std::vector<SAT_Expression *> &operands) {
+  SAT_Expression *value = table->trueExpression;
+  for (SAT_Expression *operand : operands) value = new_and(table, value, operand);
+  return value;
+}
+
+// Removes the true and false operands and returns the bound that is left for the others, every true operand uses up
+// one of it
+i32 drop_constant_operands(SAT_ExpressionTable *table, std::vector<SAT_Expression *> *operands, i32 bound) {
+  usize kept = 0;
+  for (SAT_Expression *operand : *operands) {
+    if (operand == table->trueExpression) {
+      --bound;
+    } else if (operand != table->falseExpression) {
+      (*operands)[kept++] = operand;
     }
   }
-  return find_index_variable_value(scope->parent, variable_id, increment);
+  operands->resize(kept);
+  return bound;
 }
 
-i32 get_xvariable_from_index_expression(Scope *scope, i32 accumulator, Expression *index_expression) {
-  switch (index_expression->kind) {
-  case ExpressionKind::GridRef: return accumulator + index_expression->grid_start_variable;
-  case ExpressionKind::Index:
+// Only bounds strictly between none and all of the operands become an ATMOST node, the others are plain AND/OR
+SAT_Expression *new_at_most(SAT_ExpressionTable *table, std::vector<SAT_Expression *> *operands, i32 bound) {
+  bound     = drop_constant_operands(table, operands, bound);
+  i32 count = (i32)operands->size();
+  if (bound < 0) return table->falseExpression;
+  if (bound >= count) return table->trueExpression;
+  if (bound == 0) return new_not(table, new_disjunction(table, *operands));
+  if (bound == count - 1) return new_not(table, new_conjunction(table, *operands));
+
+  SAT_Expression *list = nullptr;
+  for (usize i = operands->size(); i-- > 0;) list = table->node(Operator::LIST, (*operands)[i], list);
+  return table->atMost(bound, list);
+}
+
+SAT_Expression *new_at_least(SAT_ExpressionTable *table, std::vector<SAT_Expression *> *operands, i32 bound) {
+  bound     = drop_constant_operands(table, operands, bound);
+  i32 count = (i32)operands->size();
+  if (bound <= 0) return table->trueExpression;
+  if (bound > count) return table->falseExpression;
+  if (bound == 1) return new_disjunction(table, *operands);
+  if (bound == count) return new_conjunction(table, *operands);
+  return new_not(table, new_at_most(table, operands, bound - 1));
+}
+
+// The value of an AtMost or AtLeast template node
+SAT_Expression *new_cardinality(SAT_ExpressionTable *table, TemplateNodeKind::Enum kind,
+                                std::vector<SAT_Expression *> *operands, i32 bound) {
+  return kind == TemplateNodeKind::AtMost ? new_at_most(table, operands, bound) : new_at_least(table, operands, bound);
+}
+
+i32 emit_node(Translator *t, const TemplateNode &node) {
+  auto &nodes = t->templates[(u32)t->current_template].nodes;
+  nodes.push_back(node);
+  return (i32)nodes.size() - 1;
+}
+
+i32 emit_constant(Translator *t, SAT_Expression *constant) {
+  TemplateNode node;
+  node.kind     = TemplateNodeKind::Const;
+  node.constant = constant;
+  return emit_node(t, node);
+}
+
+i32 emit_operation(Translator *t, TemplateNodeKind::Enum kind, i32 left, i32 right) {
+  TemplateNode node;
+  node.kind     = kind;
+  node.operands = {left, right};
+  return emit_node(t, node);
+}
+
+// The value of node if it is known while compiling, nullptr if it depends on a loop counter
+SAT_Expression *constant_value(Translator *t, i32 node) {
+  auto &template_node = t->templates[(u32)t->current_template].nodes[(u32)node];
+  return template_node.kind == TemplateNodeKind::Const ? template_node.constant : nullptr;
+}
+
+// The compile_* functions apply new_not/new_and/new_or right away when their operands are known, and otherwise
+// emit a node that applies them when the template runs, so the result is the same as translating every iteration
+i32 compile_not(Translator *t, i32 inner) {
+  if (SAT_Expression *constant = constant_value(t, inner)) return emit_constant(t, new_not(t->table, constant));
+  return emit_operation(t, TemplateNodeKind::Not, -1, inner);
+}
+
+i32 compile_and(Translator *t, i32 left, i32 right) {
+  SAT_Expression *left_constant  = constant_value(t, left);
+  SAT_Expression *right_constant = constant_value(t, right);
+  if (left_constant && right_constant) return emit_constant(t, new_and(t->table, left_constant, right_constant));
+  if (left_constant == t->table->falseExpression || right_constant == t->table->falseExpression) {
+    return emit_constant(t, t->table->falseExpression);
+  }
+  if (left_constant == t->table->trueExpression) return right;
+  if (right_constant == t->table->trueExpression) return left;
+  if (left == right) return left;
+  return emit_operation(t, TemplateNodeKind::And, left, right);
+}
+
+i32 compile_or(Translator *t, i32 left, i32 right) {
+  SAT_Expression *left_constant  = constant_value(t, left);
+  SAT_Expression *right_constant = constant_value(t, right);
+  if (left_constant && right_constant) return emit_constant(t, new_or(t->table, left_constant, right_constant));
+  if (left_constant == t->table->trueExpression || right_constant == t->table->trueExpression) {
+    return emit_constant(t, t->table->trueExpression);
+  }
+  if (left_constant == t->table->falseExpression) return right;
+  if (right_constant == t->table->falseExpression) return left;
+  if (left == right) return left;
+  return emit_operation(t, TemplateNodeKind::Or, left, right);
+}
+
+// XOR and XNOR with a known operand are the other operand or its negation
+i32 compile_parity(Translator *t, TemplateNodeKind::Enum kind, i32 left, i32 right) {
+  SAT_Expression *left_constant  = constant_value(t, left);
+  SAT_Expression *right_constant = constant_value(t, right);
+  bool is_xor                    = kind == TemplateNodeKind::Xor;
+  if (left_constant && right_constant) {
+    return emit_constant(t, is_xor ? new_xor(t->table, left_constant, right_constant)
+                                   : new_xnor(t->table, left_constant, right_constant));
+  }
+  SAT_Expression *identity = is_xor ? t->table->falseExpression : t->table->trueExpression;
+  SAT_Expression *inverts  = is_xor ? t->table->trueExpression : t->table->falseExpression;
+  if (left_constant == identity) return right;
+  if (right_constant == identity) return left;
+  if (left_constant == inverts) return compile_not(t, right);
+  if (right_constant == inverts) return compile_not(t, left);
+  if (left == right) return emit_constant(t, is_xor ? t->table->falseExpression : t->table->trueExpression);
+  return emit_operation(t, kind, left, right);
+}
+
+i32 compile_grid_reference(Translator *t, Expression *index_expression) {
+  auto &terms    = t->templates[(u32)t->current_template].terms;
+  u32 first_term = (u32)terms.size();
+
+  // increase by 1 so that variable 0 is never created
+  i32 offset = 1;
+  for (; index_expression->kind == ExpressionKind::Index; index_expression = index_expression->index.inner) {
+    i32 dimension_size = index_expression->index.dimension_size;
     if (index_expression->index.is_constant) {
-      accumulator += index_expression->index.constant_index * index_expression->index.dimension_size;
+      offset += index_expression->index.constant_index * dimension_size;
+      continue;
+    }
+    i32 indexvar             = index_expression->index.indexvar;
+    const IndexBinding &ivar = t->indices[(u32)indexvar];
+    if (ivar.is_counter) {
+      terms.push_back({indexvar, dimension_size});
     } else {
-      i32 index_value = find_index_variable_value(scope, index_expression->index.indexvar, false);
-      accumulator += index_value * index_expression->index.dimension_size;
+      offset += ivar.value * dimension_size;
     }
-    return get_xvariable_from_index_expression(scope, accumulator, index_expression->index.inner);
-  default: assert(!"cannot get xvariable from expression kind"); return -1;
   }
+  assert(index_expression->kind == ExpressionKind::GridRef && "cannot get xvariable from expression kind");
+  offset += index_expression->grid_start_variable;
+
+  if ((u32)terms.size() == first_term) return emit_constant(t, t->table->literal(offset));
+  TemplateNode node;
+  node.kind    = TemplateNodeKind::Literal;
+  node.literal = {offset, first_term, (u32)terms.size() - first_term};
+  return emit_node(t, node);
 }
 
-SAT_Expression *translate_expression_to_sat(Scope *scope, Expression *expression) {
-  switch (expression->kind) {
-  case ExpressionKind::False: return &false_sat;
-  case ExpressionKind::True: return &true_sat;
-  case ExpressionKind::LVar:
-    return translate_expression_to_sat(scope, find_local_variable_value(scope, expression->lvar));
-  case ExpressionKind::Not: return new_not(translate_expression_to_sat(scope, expression->unary.inner));
-  case ExpressionKind::And:
-    return new_and(translate_expression_to_sat(scope, expression->binary.left),
-                   translate_expression_to_sat(scope, expression->binary.right));
-  case ExpressionKind::Or:
-    return new_or(translate_expression_to_sat(scope, expression->binary.left),
-                  translate_expression_to_sat(scope, expression->binary.right));
-  case ExpressionKind::GridRef: assert(!"cannot translate gridref directly"); break;
-  case ExpressionKind::Index:
-    // increase by 1 so that variable 0 is never created
-    return new SAT_Expression(get_xvariable_from_index_expression(scope, 0, expression) + 1);
-  default: assert(!"TODO: unimplemented translation of expression to sat"); return nullptr;
+// Exactly is compiled to at most and at least the bound, both over the same operand nodes
+i32 compile_cardinality(Translator *t, Expression *expression, const i32 *operands, u32 operand_count) {
+  bool is_constant = true;
+  for (u32 i = 0; i < operand_count; ++i) is_constant = is_constant && constant_value(t, operands[i]);
+
+  i32 bound = expression->cardinality.bound;
+  std::vector<TemplateNodeKind::Enum> kinds;
+  if (expression->kind != ExpressionKind::AtLeast) kinds.push_back(TemplateNodeKind::AtMost);
+  if (expression->kind != ExpressionKind::AtMost) kinds.push_back(TemplateNodeKind::AtLeast);
+
+  if (is_constant) {
+    SAT_Expression *value = t->table->trueExpression;
+    std::vector<SAT_Expression *> constants;
+    for (TemplateNodeKind::Enum kind : kinds) {
+      constants.clear();
+      for (u32 i = 0; i < operand_count; ++i) constants.push_back(constant_value(t, operands[i]));
+      value = new_and(t->table, value, new_cardinality(t->table, kind, &constants, bound));
+    }
+    return emit_constant(t, value);
+  }
+
+  auto &operand_nodes = t->templates[(u32)t->current_template].operand_nodes;
+  u32 first_operand   = (u32)operand_nodes.size();
+  operand_nodes.insert(operand_nodes.end(), operands, operands + operand_count);
+  i32 result = emit_constant(t, t->table->trueExpression);
+  for (TemplateNodeKind::Enum kind : kinds) {
+    TemplateNode node;
+    node.kind        = kind;
+    node.cardinality = {bound, first_operand, operand_count};
+    result           = compile_and(t, result, emit_node(t, node));
+  }
+  return result;
+}
+
+// Operands are compiled left to right on an explicit stack, since a long chain of operators nests as deep as it is
+// long. A local variable compiles to the node of its binding, which is compiled once while the bindings stay the same.
+i32 compile_expression(Translator *t, Expression *expression) {
+  struct Pending {
+    Expression *expression;
+    bool operands_compiled;
+  };
+  std::vector<Pending> stack{{expression, false}};
+  std::vector<i32> nodes;
+  while (stack.size()) {
+    Pending top = stack.back();
+    stack.pop_back();
+    Expression *e = top.expression;
+
+    if (top.operands_compiled) {
+      switch (e->kind) {
+      case ExpressionKind::LVar:
+        t->local_nodes[(u32)e->lvar]    = nodes.back();
+        t->local_versions[(u32)e->lvar] = t->bindings_version;
+        break;
+      case ExpressionKind::Not: nodes.back() = compile_not(t, nodes.back()); break;
+      case ExpressionKind::AtMost:
+      case ExpressionKind::AtLeast:
+      case ExpressionKind::Exactly: {
+        u32 operand_count = 0;
+        for (Expression *list = e->cardinality.operands; list; list = list->binary.right) ++operand_count;
+        usize first = nodes.size() - operand_count;
+        i32 result  = compile_cardinality(t, e, nodes.data() + first, operand_count);
+        nodes.resize(first);
+        nodes.push_back(result);
+        break;
+      }
+      default: {
+        i32 right = nodes.back();
+        nodes.pop_back();
+        i32 left = nodes.back();
+        switch (e->kind) {
+        case ExpressionKind::And: nodes.back() = compile_and(t, left, right); break;
+        case ExpressionKind::Or: nodes.back() = compile_or(t, left, right); break;
+        default:
+          nodes.back() = compile_parity(
+              t, e->kind == ExpressionKind::Xor ? TemplateNodeKind::Xor : TemplateNodeKind::Xnor, left, right);
+          break;
+        }
+        break;
+      }
+      }
+      continue;
+    }
+
+    switch (e->kind) {
+    case ExpressionKind::False: nodes.push_back(emit_constant(t, t->table->falseExpression)); break;
+    case ExpressionKind::True: nodes.push_back(emit_constant(t, t->table->trueExpression)); break;
+    case ExpressionKind::LVar:
+      if (t->local_versions[(u32)e->lvar] == t->bindings_version) {
+        assert(t->local_nodes[(u32)e->lvar] >= 0 && "local variable bound to an expression that reads itself");
+        nodes.push_back(t->local_nodes[(u32)e->lvar]);
+        break;
+      }
+      // marks the binding as being compiled until its node is known
+      t->local_nodes[(u32)e->lvar]    = -1;
+      t->local_versions[(u32)e->lvar] = t->bindings_version;
+      stack.push_back({e, true});
+      stack.push_back({t->locals[(u32)e->lvar].value, false});
+      break;
+    case ExpressionKind::Not:
+      stack.push_back({e, true});
+      stack.push_back({e->unary.inner, false});
+      break;
+    case ExpressionKind::And:
+    case ExpressionKind::Or:
+    case ExpressionKind::Xor:
+    case ExpressionKind::Xnor:
+      stack.push_back({e, true});
+      stack.push_back({e->binary.right, false});
+      stack.push_back({e->binary.left, false});
+      break;
+    case ExpressionKind::GridRef:
+      assert(!"cannot translate gridref directly");
+      nodes.push_back(-1);
+      break;
+    case ExpressionKind::Index: nodes.push_back(compile_grid_reference(t, e)); break;
+    case ExpressionKind::AtMost:
+    case ExpressionKind::AtLeast:
+    case ExpressionKind::Exactly: {
+      // pushed in reverse so the operands are compiled in list order
+      stack.push_back({e, true});
+      usize first = stack.size();
+      for (Expression *list = e->cardinality.operands; list; list = list->binary.right) {
+        stack.push_back({list->binary.left, false});
+      }
+      std::reverse(stack.begin() + (std::ptrdiff_t)first, stack.end());
+      break;
+    }
+    default:
+      assert(!"TODO: unimplemented translation of expression to sat");
+      nodes.push_back(-1);
+      break;
+    }
   }
+  return nodes.back();
 }
 
-SAT_Expression *translate_block_to_sat(Scope *parent_scope, BasicBlock *bb) {
-  Scope scope;
-  scope.parent = parent_scope;
+i32 compile_template(Translator *t, BasicBlock *bb);
+
+// What the result handed to a block being compiled is: the value of its terminator, or of the then or else block of
+// its branch
+enum class BlockStage { Terminator, Then, Else };
+
+// A block whose compilation waits for the blocks its terminator continues to. The bindings it made stay in effect
+// until it is closed, key is its join key when the result is shared by all paths that reach it.
+struct BlockFrame {
+  BasicBlock *bb;
+  std::vector<i64> key;
+  usize saved_local_mark;
+  usize saved_index_mark;
+  i32 statement_result;
+  BlockStage stage;
+  i32 condition;
+  i32 not_condition;
+  i32 then_result;
+};
 
-  SAT_Expression *statement_result = &true_sat;
+// Binds the assignments of frame->bb and compiles its loops into frame->statement_result
+void open_block(Translator *t, BlockFrame *frame) {
+  BasicBlock *bb          = frame->bb;
+  i32 block_depth         = ++t->block_depth;
+  frame->saved_local_mark = t->saved_locals.size();
+  frame->saved_index_mark = t->saved_indices.size();
+
+  i32 statement_result = emit_constant(t, t->table->trueExpression);
 
   for (auto &inst : bb->insts) {
     switch (inst.kind) {
-    case InstructionKind::Assign: scope.local_variable_context.push_back(inst.assign); break;
+    case InstructionKind::Assign: {
+      LocalBinding &binding = t->locals[(u32)inst.assign.localvar];
+      if (binding.block_depth == block_depth) break;
+      t->saved_locals.push_back({inst.assign.localvar, binding});
+      binding = {inst.assign.right_value_expression, block_depth};
+      ++t->bindings_version;
+      break;
+    }
     case InstructionKind::Loop: {
-      scope.index_variable_context.push_back({inst.loop.indexvar, 0});
-      SAT_Expression *loop = translate_block_to_sat(&scope, inst.loop.inner_bb);
-      for (i32 i = 1; i < inst.loop.length; ++i) {
-        find_index_variable_value(&scope, inst.loop.indexvar, true);
-        loop = new_or(loop, translate_block_to_sat(&scope, inst.loop.inner_bb));
+      IndexBinding *counter = &t->indices[(u32)inst.loop.indexvar];
+      if (counter->block_depth != block_depth) {
+        t->saved_indices.push_back({inst.loop.indexvar, *counter});
+        *counter = {false, 0, block_depth};
       }
-      statement_result = new_and(statement_result, loop);
+
+      TemplateNode loop;
+      loop.kind            = TemplateNodeKind::Loop;
+      loop.loop.indexvar   = inst.loop.indexvar;
+      loop.loop.start      = counter->value;
+      loop.loop.iterations = std::max(inst.loop.length, 1);
+
+      counter->is_counter     = true;
+      loop.loop.body_template = compile_template(t, inst.loop.inner_bb);
+      counter->is_counter     = false;
+      counter->value          = loop.loop.start + loop.loop.iterations - 1;
+      statement_result        = compile_and(t, statement_result, emit_node(t, loop));
+      ++t->bindings_version;
       break;
     }
     default: assert(!"TODO: unimplemented translation of block statement"); break;
     }
   }
+  frame->statement_result = statement_result;
+}
+
+// Undoes the bindings of frame->bb and returns its value given the value of its terminator
+i32 close_block(Translator *t, BlockFrame *frame, i32 terminator_result) {
+  if (t->saved_locals.size() > frame->saved_local_mark || t->saved_indices.size() > frame->saved_index_mark) {
+    ++t->bindings_version;
+  }
+  while (t->saved_locals.size() > frame->saved_local_mark) {
+    t->locals[(u32)t->saved_locals.back().id] = t->saved_locals.back().binding;
+    t->saved_locals.pop_back();
+  }
+  while (t->saved_indices.size() > frame->saved_index_mark) {
+    t->indices[(u32)t->saved_indices.back().id] = t->saved_indices.back().binding;
+    t->saved_indices.pop_back();
+  }
+  t->block_depth--;
+
+  i32 result = compile_and(t, frame->statement_result, terminator_result);
+  if (!frame->key.empty()) t->templates[(u32)t->current_template].joins.emplace(std::move(frame->key), result);
+  return result;
+}
+
+void count_predecessors(Translator *t, BasicBlock *entry_bb) {
+  std::vector<bool> visited(t->blocks.size(), false);
+  std::vector<BasicBlock *> worklist;
+  auto reach = [&](BasicBlock *bb) {
+    if (visited[(u32)bb->id]) return;
+    visited[(u32)bb->id] = true;
+    worklist.push_back(bb);
+  };
+
+  // loop bodies are entered from their loop instruction once per iteration, they are never joins
+  reach(entry_bb);
+  while (worklist.size()) {
+    auto *bb = worklist.back();
+    worklist.pop_back();
+    for (auto &inst : bb->insts) {
+      if (inst.kind == InstructionKind::Loop) reach(inst.loop.inner_bb);
+    }
+    switch (bb->terminator_kind) {
+    case TerminatorKind::Goto:
+      t->blocks[(u32)bb->go.goto_bb->id].predecessor_count++;
+      reach(bb->go.goto_bb);
+      break;
+    case TerminatorKind::Branch:
+      t->blocks[(u32)bb->branch.then_bb->id].predecessor_count++;
+      t->blocks[(u32)bb->branch.else_bb->id].predecessor_count++;
+      reach(bb->branch.then_bb);
+      reach(bb->branch.else_bb);
+      break;
+    default: break;
+    }
+  }
+}
+
+// Expressions are walked with an explicit stack, long chains of && and || nest as deep as they are long
+void collect_expression_reads(Expression *expression, std::vector<u64> *reads) {
+  std::vector<Expression *> stack{expression};
+  while (stack.size()) {
+    Expression *top = stack.back();
+    stack.pop_back();
+    switch (top->kind) {
+    case ExpressionKind::LVar: (*reads)[(u32)top->lvar / 64] |= u64(1) << ((u32)top->lvar % 64); break;
+    case ExpressionKind::Not: stack.push_back(top->unary.inner); break;
+    case ExpressionKind::And:
+    case ExpressionKind::Or:
+    case ExpressionKind::Xor:
+    case ExpressionKind::Xnor:
+      stack.push_back(top->binary.right);
+      stack.push_back(top->binary.left);
+      break;
+    case ExpressionKind::AtMost:
+    case ExpressionKind::AtLeast:
+    case ExpressionKind::Exactly:
+      for (Expression *list = top->cardinality.operands; list; list = list->binary.right) {
+        stack.push_back(list->binary.left);
+      }
+      break;
+    default: break;
+    }
+  }
+}
 
-  SAT_Expression *terminator_result;
+// Loop bodies and the blocks the terminator continues to
+template <typename F> void for_each_successor(BasicBlock *bb, F &&visit) {
+  for (auto &inst : bb->insts) {
+    if (inst.kind == InstructionKind::Loop) visit(inst.loop.inner_bb);
+  }
   switch (bb->terminator_kind) {
-  case TerminatorKind::Goto: terminator_result = translate_block_to_sat(&scope, bb->go.goto_bb); break;
-  case TerminatorKind::Branch: {
-    SAT_Expression *cond     = translate_expression_to_sat(&scope, bb->branch.condition_expression);
-    SAT_Expression *not_cond = new_not(cond);
-    SAT_Expression *then_sat = new_and(cond, translate_block_to_sat(&scope, bb->branch.then_bb));
-    SAT_Expression *else_sat = new_and(not_cond, translate_block_to_sat(&scope, bb->branch.else_bb));
-    terminator_result        = new_or(then_sat, else_sat);
+  case TerminatorKind::Goto: visit(bb->go.goto_bb); break;
+  case TerminatorKind::Branch:
+    visit(bb->branch.then_bb);
+    visit(bb->branch.else_bb);
     break;
+  default: break;
   }
-  case TerminatorKind::Return:
-    terminator_result = translate_expression_to_sat(&scope, bb->ret.return_expression);
-    break;
-  case TerminatorKind::End: terminator_result = &true_sat; break;
-  default: assert(!"Unreachable"); break;
+}
+
+// The reads of a block include those of its successors, which are computed first. A block stays on the stack until
+// all of its successors are done, so a path of any length only takes stack entries, not C++ stack frames.
+const std::vector<u64> &block_reads(Translator *t, BasicBlock *entry_bb) {
+  std::vector<BasicBlock *> stack{entry_bb};
+  while (stack.size()) {
+    BasicBlock *bb  = stack.back();
+    BlockInfo &info = t->blocks[(u32)bb->id];
+    if (info.reads_computed) {
+      stack.pop_back();
+      continue;
+    }
+    usize pending = stack.size();
+    for_each_successor(bb, [&](BasicBlock *successor) {
+      if (!t->blocks[(u32)successor->id].reads_computed) stack.push_back(successor);
+    });
+    if (stack.size() != pending) continue;
+    stack.pop_back();
+
+    std::vector<u64> reads((u32)(t->local_variable_count + 63) / 64, 0);
+    for (auto &inst : bb->insts) {
+      if (inst.kind == InstructionKind::Assign) collect_expression_reads(inst.assign.right_value_expression, &reads);
+    }
+    if (bb->terminator_kind == TerminatorKind::Branch) {
+      collect_expression_reads(bb->branch.condition_expression, &reads);
+    } else if (bb->terminator_kind == TerminatorKind::Return) {
+      collect_expression_reads(bb->ret.return_expression, &reads);
+    }
+    for_each_successor(bb, [&](BasicBlock *successor) {
+      const std::vector<u64> &other = t->blocks[(u32)successor->id].reads;
+      for (u32 i = 0; i < reads.size(); ++i) reads[i] |= other[i];
+    });
+    info.reads          = std::move(reads);
+    info.reads_computed = true;
   }
+  return t->blocks[(u32)entry_bb->id].reads;
+}
+
+// Everything the compiled bb depends on besides bb itself: the value of every index variable, which is the same
+// for all paths when it is a loop counter, and the binding of every local variable the block can read. Bindings are
+// evaluated lazily where they are used, so the local variables read by a binding are observed by the block as well.
+std::vector<i64> join_key(Translator *t, BasicBlock *bb) {
+  std::vector<i64> key;
+  key.push_back(bb->id);
+  for (const IndexBinding &ivar : t->indices) key.push_back(ivar.is_counter ? INT64_MIN : ivar.value);
+
+  std::vector<u64> observed = block_reads(t, bb);
+  std::vector<i32> pending;
+  for (i32 lvar = 0; lvar < t->local_variable_count; ++lvar) {
+    if (observed[(u32)lvar / 64] >> ((u32)lvar % 64) & 1) pending.push_back(lvar);
+  }
+  std::vector<u64> binding_reads(observed.size());
+  while (pending.size()) {
+    i32 lvar = pending.back();
+    pending.pop_back();
+    Expression *binding = t->locals[(u32)lvar].value;
+    key.push_back(lvar);
+    key.push_back((i64)(intptr_t)binding);
+    if (!binding) continue;
+
+    std::fill(binding_reads.begin(), binding_reads.end(), 0);
+    collect_expression_reads(binding, &binding_reads);
+    for (u32 i = 0; i < observed.size(); ++i) {
+      u64 added = binding_reads[i] & ~observed[i];
+      observed[i] |= added;
+      for (; added; added &= added - 1) pending.push_back(i32(i * 64 + (u32)__builtin_ctzll(added)));
+    }
+  }
+  return key;
+}
+
+// A block is the and of its statements and its terminator, a branch is (cond ^ then) v (!cond ^ else). The blocks a
+// terminator continues to are compiled with an explicit stack of frames like the Tseitin transform walks formulas,
+// since a function with a long run of ifs has paths thousands of blocks long. Nodes are emitted in the same order as
+// the straightforward recursion would.
+i32 compile_block(Translator *t, BasicBlock *entry_bb) {
+  std::vector<BlockFrame> frames;
+  BasicBlock *next = entry_bb; // block to compile, null when result is the value the frame on top waits for
+  i32 result       = -1;
+  for (;;) {
+    if (next) {
+      BlockFrame frame = {};
+      frame.bb         = next;
+      next             = nullptr;
+      bool is_cached   = false;
+      if (t->blocks[(u32)frame.bb->id].predecessor_count >= 2) {
+        frame.key   = join_key(t, frame.bb);
+        auto &joins = t->templates[(u32)t->current_template].joins;
+        auto it     = joins.find(frame.key);
+        is_cached   = it != joins.end();
+        if (is_cached) result = it->second;
+      }
+      if (!is_cached) {
+        frames.push_back(std::move(frame));
+        BlockFrame *top = &frames.back();
+        BasicBlock *bb  = top->bb;
+        open_block(t, top);
+        top->stage = BlockStage::Terminator;
+        switch (bb->terminator_kind) {
+        case TerminatorKind::Goto: next = bb->go.goto_bb; continue;
+        case TerminatorKind::Branch:
+          top->condition     = compile_expression(t, bb->branch.condition_expression);
+          top->not_condition = compile_not(t, top->condition);
+          top->stage         = BlockStage::Then;
+          next               = bb->branch.then_bb;
+          continue;
+        case TerminatorKind::Return: result = compile_expression(t, bb->ret.return_expression); break;
+        case TerminatorKind::End: result = emit_constant(t, t->table->trueExpression); break;
+        default: assert(!"Unreachable"); break;
+        }
+      }
+    }
+    if (frames.empty()) return result;
+
+    BlockFrame *top = &frames.back();
+    switch (top->stage) {
+    case BlockStage::Then:
+      top->then_result = compile_and(t, top->condition, result);
+      top->stage       = BlockStage::Else;
+      next             = top->bb->branch.else_bb;
+      continue;
+    case BlockStage::Else: result = compile_or(t, top->then_result, compile_and(t, top->not_condition, result)); break;
+    default: break;
+    }
+    result = close_block(t, top, result);
+    frames.pop_back();
+  }
+}
+
+i32 compile_template(Translator *t, BasicBlock *bb) {
+  i32 enclosing_template = t->current_template;
+  t->current_template    = (i32)t->templates.size();
+  t->templates.emplace_back();
+  ++t->bindings_version;
+
+  i32 root = compile_block(t, bb);
+
+  i32 compiled_template                     = t->current_template;
+  t->templates[(u32)compiled_template].root = root;
+  t->current_template                       = enclosing_template;
+  ++t->bindings_version;
+  return compiled_template;
+}
+
+SAT_Expression *run_template(const Translator *t, TemplateRunner *runner, i32 template_index, ParallelRun *parallel);
 
-  return new_and(statement_result, terminator_result);
+// Copies a node a worker made in its overlay, and every overlay node below it, into the shared table. Children are
+// imported before their parents with an explicit stack, nodes the overlay found in the shared table are used as is.
+SAT_Expression *import_node(SAT_ExpressionTable *table, LoopWorker *worker, SAT_Expression *expression) {
+  i32 first_id  = worker->overlay->firstId();
+  auto imported = [&](SAT_Expression *node) -> SAT_Expression * {
+    if (!node || node->id < first_id) return node;
+    return worker->imported[(u32)(node->id - first_id)];
+  };
+
+  std::vector<SAT_Expression *> stack;
+  if (imported(expression) == nullptr) stack.push_back(expression);
+  while (!stack.empty()) {
+    SAT_Expression *top = stack.back();
+    if (top->leftChild && !imported(top->leftChild)) {
+      stack.push_back(top->leftChild);
+    } else if (top->rightChild && !imported(top->rightChild)) {
+      stack.push_back(top->rightChild);
+    } else {
+      stack.pop_back();
+      SAT_Expression *&copy = worker->imported[(u32)(top->id - first_id)];
+      if (copy) continue;
+      copy = table->copy(top, imported(top->leftChild), imported(top->rightChild));
+    }
+  }
+  return imported(expression);
 }
 
-SAT_Expression *generate_sat(CFG *cfg) { return translate_block_to_sat(nullptr, cfg->entry_bb); }
+// Runs every iteration of a loop node on the pool. Iterations only differ in the counter, so each one runs on a copy
+// of the counters with its worker's overlay table while the shared table is left alone. Afterwards the results are
+// imported and or'd together in iteration order, so the formula is the same one the serial loop builds.
+SAT_Expression *run_loop_parallel(TemplateRunner *runner, const Translator *t, const LoopNode &loop,
+                                  ParallelRun *parallel) {
+  for (LoopWorker &worker : parallel->workers) {
+    worker.overlay->clear();
+    worker.runner.counters = runner->counters;
+  }
+  parallel->results.assign((u32)loop.iterations, nullptr);
+  parallel->result_workers.assign((u32)loop.iterations, 0);
+  parallel->pool->run(loop.iterations, [&](i32 iteration, i32 worker_index) {
+    TemplateRunner *worker_runner                   = &parallel->workers[(u32)worker_index].runner;
+    worker_runner->counters[(u32)loop.indexvar]     = loop.start + iteration;
+    parallel->results[(u32)iteration]              = run_template(t, worker_runner, loop.body_template, nullptr);
+    parallel->result_workers[(u32)iteration]       = worker_index;
+  });
+
+  for (LoopWorker &worker : parallel->workers) {
+    worker.imported.assign((u32)(worker.overlay->size() - worker.overlay->firstId()), nullptr);
+  }
+  SAT_Expression *value = nullptr;
+  for (i32 iteration = 0; iteration < loop.iterations; ++iteration) {
+    LoopWorker *worker            = &parallel->workers[(u32)parallel->result_workers[(u32)iteration]];
+    SAT_Expression *iteration_sat = import_node(runner->table, worker, parallel->results[(u32)iteration]);
+    value                         = iteration == 0 ? iteration_sat : new_or(runner->table, value, iteration_sat);
+  }
+  return value;
+}
+
+// parallel is null inside workers, loops nested in a loop that already runs in parallel run serially
+SAT_Expression *run_template(const Translator *t, TemplateRunner *runner, i32 template_index, ParallelRun *parallel) {
+  const SatTemplate &compiled          = t->templates[(u32)template_index];
+  std::vector<SAT_Expression *> &values = runner->values[(u32)template_index];
+  values.resize(compiled.nodes.size());
+  for (u32 i = 0; i < compiled.nodes.size(); ++i) {
+    const TemplateNode &node = compiled.nodes[i];
+    SAT_Expression *&value   = values[i];
+    switch (node.kind) {
+    case TemplateNodeKind::Const: value = node.constant; break;
+    case TemplateNodeKind::Literal: {
+      i32 variable = node.literal.offset;
+      for (u32 k = 0; k < node.literal.term_count; ++k) {
+        const AffineTerm &term = compiled.terms[node.literal.first_term + k];
+        variable += term.coefficient * runner->counters[(u32)term.indexvar];
+      }
+      value = runner->table->literal(variable);
+      break;
+    }
+    case TemplateNodeKind::Not: value = new_not(runner->table, values[(u32)node.operands.right]); break;
+    case TemplateNodeKind::And:
+      value = new_and(runner->table, values[(u32)node.operands.left], values[(u32)node.operands.right]);
+      break;
+    case TemplateNodeKind::Or:
+      value = new_or(runner->table, values[(u32)node.operands.left], values[(u32)node.operands.right]);
+      break;
+    case TemplateNodeKind::Xor:
+      value = new_xor(runner->table, values[(u32)node.operands.left], values[(u32)node.operands.right]);
+      break;
+    case TemplateNodeKind::Xnor:
+      value = new_xnor(runner->table, values[(u32)node.operands.left], values[(u32)node.operands.right]);
+      break;
+    case TemplateNodeKind::AtMost:
+    case TemplateNodeKind::AtLeast: {
+      runner->operands.clear();
+      for (u32 k = 0; k < node.cardinality.operand_count; ++k) {
+        runner->operands.push_back(values[(u32)compiled.operand_nodes[node.cardinality.first_operand + k]]);
+      }
+      value = new_cardinality(runner->table, node.kind, &runner->operands, node.cardinality.bound);
+      break;
+    }
+    case TemplateNodeKind::Loop: {
+      if (parallel && node.loop.iterations > 1) {
+        value = run_loop_parallel(runner, t, node.loop, parallel);
+        break;
+      }
+      // the loop is the disjunction of its iterations
+      i32 &counter = runner->counters[(u32)node.loop.indexvar];
+      i32 saved    = counter;
+      for (i32 iteration = 0; iteration < node.loop.iterations; ++iteration) {
+        counter                       = node.loop.start + iteration;
+        SAT_Expression *iteration_sat = run_template(t, runner, node.loop.body_template, parallel);
+        value = iteration == 0 ? iteration_sat : new_or(runner->table, value, iteration_sat);
+      }
+      counter = saved;
+      break;
+    }
+    default: assert(!"Unreachable"); break;
+    }
+  }
+  return values[(u32)compiled.root];
+}
+
+SAT_Expression *generate_sat(CFG *cfg, SAT_ExpressionTable *table, ThreadPool *pool) {
+  Translator translator;
+  translator.table                = table;
+  translator.local_variable_count = cfg->local_variable_count;
+  translator.index_variable_count = cfg->index_variable_count;
+  translator.current_template     = -1;
+  translator.blocks.resize((u32)cfg->block_count);
+  translator.locals.resize((u32)cfg->local_variable_count, {nullptr, -1});
+  translator.indices.resize((u32)cfg->index_variable_count, {false, -1, -1});
+  translator.block_depth      = 0;
+  translator.bindings_version = 1;
+  translator.local_nodes.resize((u32)cfg->local_variable_count, -1);
+  translator.local_versions.resize((u32)cfg->local_variable_count, 0);
+  count_predecessors(&translator, cfg->entry_bb);
+
+  // the program outside of any loop has no counters, so its template is folded to constants and loop nodes
+  i32 program = compile_template(&translator, cfg->entry_bb);
+
+  TemplateRunner runner;
+  runner.table = table;
+  runner.counters.resize((u32)cfg->index_variable_count);
+  runner.values.resize(translator.templates.size());
+  if (!pool || pool->thread_count() <= 1) return run_template(&translator, &runner, program, nullptr);
+
+  ParallelRun parallel;
+  parallel.pool = pool;
+  parallel.workers.resize((u32)pool->thread_count());
+  for (LoopWorker &worker : parallel.workers) {
+    worker.overlay.reset(new SAT_ExpressionTable(table));
+    worker.runner.table = worker.overlay.get();
+    worker.runner.values.resize(translator.templates.size());
+  }
+  SAT_Expression *sat = run_template(&translator, &runner, program, &parallel);
+  for (LoopWorker &worker : parallel.workers) table->addLookups(*worker.overlay);
+  return sat;
+}
 
 } // namespace slang
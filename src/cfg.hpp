@@ -1,12 +1,15 @@
 #ifndef CFG_HPP
 #define CFG_HPP
 
+#include "arena.hpp"
 #include "general.hpp"
 #include "sat_syntax_tree.hpp"
 #include <vector>
 
 namespace slang {
 
+class ThreadPool;
+
 // clang-format off
 #define EXPRESSION_KIND(pick) \
   pick(None,    "'None'"), \
@@ -16,8 +19,14 @@ namespace slang {
   pick(Not,     "Not"), \
   pick(And,     "And"), \
   pick(Or,      "Or"), \
+  pick(Xor,     "Xor"), \
+  pick(Xnor,    "Xnor"), \
   pick(GridRef, "GridRef"), \
-  pick(Index,   "Index"),
+  pick(Index,   "Index"), \
+  pick(AtMost,  "AtMost"), \
+  pick(AtLeast, "AtLeast"), \
+  pick(Exactly, "Exactly"), \
+  pick(List,    "List"),
 DECLARE_KIND(EXPRESSION_KIND, ExpressionKind);
 
 struct Expression;
@@ -43,6 +52,13 @@ struct IndexExpression {
   };
 };
 
+// Holds when at most, at least or exactly bound of the operands hold. The operands are a chain of List expressions
+// with one operand as left and the rest of the chain as right, null after the last operand.
+struct CardinalityExpression {
+  i32 bound;
+  Expression *operands;
+};
+
 struct Expression {
   ExpressionKind::Enum kind;
   union {
@@ -51,6 +67,7 @@ struct Expression {
     BinaryExpression binary;
     i32 grid_start_variable;
     IndexExpression index;
+    CardinalityExpression cardinality;
   };
 };
 
@@ -122,12 +139,37 @@ struct BasicBlock {
 
 struct CFG {
   BasicBlock *entry_bb;
-  char *file_data;
+
+  // source text the spans of the parser point into, mapped read-only when it was read from a regular file
+  const char *file_data = nullptr;
+  i32 file_length       = 0;
+  bool file_mapped      = false;
+
+  // every expression and block of the CFG, cleared when another file is parsed into the same CFG
+  Pool<Expression> expressions;
+  Pool<BasicBlock> blocks;
+
+  // grid variables are numbered 1 to variable_count in the generated SAT expression
+  i32 variable_count;
+
+  // local variables, index variables and blocks have dense ids below these counts
+  i32 local_variable_count;
+  i32 index_variable_count;
+  i32 block_count;
+
+  // tokens the lexer produced for the source
+  i32 token_count;
 };
 
 void dump_cfg(CFG *cfg);
 
-SAT_Expression *generate_sat(CFG *cfg);
+// Folds constants through local variables and expressions, turns branches on a known condition into gotos and gives
+// the blocks that are still reachable dense ids. The formula generate_sat builds afterwards is unchanged.
+void optimize_cfg(CFG *cfg);
+
+// Builds the formula of the program in table. With a pool of more than one thread the iterations of loops run in
+// parallel, the formula is the same for every thread count.
+SAT_Expression *generate_sat(CFG *cfg, SAT_ExpressionTable *table, ThreadPool *pool = nullptr);
 
 } // namespace slang
 
@@ -0,0 +1,366 @@
+#include "cfg.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+namespace slang {
+
+// Local variables are bound lazily: a use evaluates the bound expression with the bindings at the use, so a local
+// variable can only be replaced by a constant where the binding in effect, evaluated there, is constant. The binding
+// in effect on entry to every block is tracked by walking the blocks in topological order, a variable reached with
+// different bindings on different paths is marked as conflicting and left alone.
+struct Folder {
+  CFG *cfg;
+  Expression *false_expression;
+  Expression *true_expression;
+
+  // marks a binding that differs between the paths into a block
+  Expression conflict;
+
+  // binding of every local variable on entry to each block, for the blocks some path reaches
+  std::vector<std::vector<Expression *>> entry_bindings;
+  std::vector<bool> reached;
+
+  // local variables whose binding is being evaluated, a binding that refers to itself is never folded
+  std::vector<bool> resolving;
+
+  // folded value of a local variable's binding, nullptr when it is not constant; an entry is only valid while its
+  // stamp is block_stamp, which changes with every block
+  std::vector<Expression *> local_values;
+  std::vector<u32> local_stamps;
+  u32 block_stamp;
+};
+
+bool is_constant(Expression *expression) {
+  return expression->kind == ExpressionKind::True || expression->kind == ExpressionKind::False;
+}
+
+Expression *new_expression(Folder *f, ExpressionKind::Enum kind) {
+  Expression *expression = f->cfg->expressions.make();
+  expression->kind       = kind;
+  return expression;
+}
+
+usize operand_count(Expression *expression) {
+  switch (expression->kind) {
+  case ExpressionKind::Not: return 1;
+  case ExpressionKind::AtMost:
+  case ExpressionKind::AtLeast:
+  case ExpressionKind::Exactly: {
+    usize count = 0;
+    for (Expression *list = expression->cardinality.operands; list; list = list->binary.right) ++count;
+    return count;
+  }
+  default: return 2;
+  }
+}
+
+// Folds expression from its folded operands, in the order they appear in expression. Returns expression itself when
+// nothing folds, the shared true/false expression when the value is known and otherwise a new expression, so
+// expressions of the parser are never modified.
+Expression *fold_operation(Folder *f, Expression *expression, Expression **operands) {
+  switch (expression->kind) {
+  case ExpressionKind::Not: {
+    Expression *inner = operands[0];
+    if (inner->kind == ExpressionKind::True) return f->false_expression;
+    if (inner->kind == ExpressionKind::False) return f->true_expression;
+    if (inner == expression->unary.inner) return expression;
+    Expression *folded  = new_expression(f, ExpressionKind::Not);
+    folded->unary.inner = inner;
+    return folded;
+  }
+  case ExpressionKind::And:
+  case ExpressionKind::Or: {
+    Expression *left  = operands[0];
+    Expression *right = operands[1];
+    // the value that decides the operation on its own, and the one that leaves the other operand
+    bool is_and                   = expression->kind == ExpressionKind::And;
+    Expression *absorb            = is_and ? f->false_expression : f->true_expression;
+    ExpressionKind::Enum identity = is_and ? ExpressionKind::True : ExpressionKind::False;
+    if (left->kind == absorb->kind || right->kind == absorb->kind) return absorb;
+    if (left->kind == identity) return right;
+    if (right->kind == identity) return left;
+    if (left == expression->binary.left && right == expression->binary.right) return expression;
+    Expression *folded   = new_expression(f, expression->kind);
+    folded->binary.left  = left;
+    folded->binary.right = right;
+    return folded;
+  }
+  case ExpressionKind::Xor:
+  case ExpressionKind::Xnor: {
+    Expression *left  = operands[0];
+    Expression *right = operands[1];
+    // a constant operand leaves the other one as it is or negated
+    ExpressionKind::Enum identity = expression->kind == ExpressionKind::Xor ? ExpressionKind::False
+                                                                            : ExpressionKind::True;
+    if (is_constant(left) && is_constant(right)) {
+      return (left->kind == right->kind) == (identity == ExpressionKind::True) ? f->true_expression
+                                                                               : f->false_expression;
+    }
+    if (left->kind == identity) return right;
+    if (right->kind == identity) return left;
+    if (is_constant(left) || is_constant(right)) {
+      Expression *folded  = new_expression(f, ExpressionKind::Not);
+      folded->unary.inner = is_constant(left) ? right : left;
+      return folded;
+    }
+    if (left == expression->binary.left && right == expression->binary.right) return expression;
+    Expression *folded   = new_expression(f, expression->kind);
+    folded->binary.left  = left;
+    folded->binary.right = right;
+    return folded;
+  }
+  case ExpressionKind::AtMost:
+  case ExpressionKind::AtLeast:
+  case ExpressionKind::Exactly: {
+    // constant operands are dropped, a true one takes one off the bound
+    std::vector<Expression *> kept;
+    i32 bound    = expression->cardinality.bound;
+    bool changed = false;
+    for (Expression *list = expression->cardinality.operands; list; list = list->binary.right) {
+      Expression *operand = *operands++;
+      changed             = changed || operand != list->binary.left;
+      if (operand->kind == ExpressionKind::True) --bound;
+      if (!is_constant(operand)) kept.push_back(operand);
+    }
+    i32 count           = (i32)kept.size();
+    bool at_most_holds  = bound >= count;
+    bool at_least_holds = bound <= 0;
+    switch (expression->kind) {
+    case ExpressionKind::AtMost:
+      if (bound < 0) return f->false_expression;
+      if (at_most_holds) return f->true_expression;
+      break;
+    case ExpressionKind::AtLeast:
+      if (bound > count) return f->false_expression;
+      if (at_least_holds) return f->true_expression;
+      break;
+    default:
+      if (bound < 0 || bound > count) return f->false_expression;
+      if (at_most_holds && at_least_holds) return f->true_expression;
+      break;
+    }
+    if (!changed) return expression;
+
+    Expression *folded           = new_expression(f, expression->kind);
+    folded->cardinality.bound    = bound;
+    folded->cardinality.operands = nullptr;
+    Expression **tail            = &folded->cardinality.operands;
+    for (Expression *operand : kept) {
+      Expression *element   = new_expression(f, ExpressionKind::List);
+      element->binary.left  = operand;
+      element->binary.right = nullptr;
+      *tail                 = element;
+      tail                  = &element->binary.right;
+    }
+    return folded;
+  }
+  default: return expression;
+  }
+}
+
+// Folds expression where bindings are the bindings in effect, or without looking through local variables when
+// bindings is null. The operands are folded on an explicit stack, long chains of operators nest as deep as they are
+// long. A local variable is folded once per block, its value is kept in local_values until the next block.
+Expression *fold_expression(Folder *f, Expression *expression, const std::vector<Expression *> *bindings) {
+  struct Pending {
+    Expression *expression;
+    bool operands_folded;
+  };
+  std::vector<Pending> stack{{expression, false}};
+  std::vector<Expression *> values;
+  while (stack.size()) {
+    Pending top = stack.back();
+    stack.pop_back();
+    Expression *e = top.expression;
+
+    if (top.operands_folded) {
+      if (e->kind == ExpressionKind::LVar) {
+        u32 lvar              = (u32)e->lvar;
+        Expression *value     = is_constant(values.back()) ? values.back() : nullptr;
+        f->resolving[lvar]    = false;
+        f->local_stamps[lvar] = f->block_stamp;
+        f->local_values[lvar] = value;
+        values.back()         = value ? value : e;
+        continue;
+      }
+      usize count       = operand_count(e);
+      Expression *value = fold_operation(f, e, values.data() + values.size() - count);
+      values.resize(values.size() - count);
+      values.push_back(value);
+      continue;
+    }
+
+    switch (e->kind) {
+    case ExpressionKind::LVar: {
+      u32 lvar = (u32)e->lvar;
+      if (!bindings) {
+        values.push_back(e);
+        break;
+      }
+      Expression *binding = (*bindings)[lvar];
+      if (!binding || binding == &f->conflict || f->resolving[lvar]) {
+        values.push_back(e);
+        break;
+      }
+      if (f->local_stamps[lvar] == f->block_stamp) {
+        values.push_back(f->local_values[lvar] ? f->local_values[lvar] : e);
+        break;
+      }
+      f->resolving[lvar] = true;
+      stack.push_back({e, true});
+      stack.push_back({binding, false});
+      break;
+    }
+    case ExpressionKind::Not:
+      stack.push_back({e, true});
+      stack.push_back({e->unary.inner, false});
+      break;
+    case ExpressionKind::And:
+    case ExpressionKind::Or:
+    case ExpressionKind::Xor:
+    case ExpressionKind::Xnor:
+      stack.push_back({e, true});
+      stack.push_back({e->binary.right, false});
+      stack.push_back({e->binary.left, false});
+      break;
+    case ExpressionKind::AtMost:
+    case ExpressionKind::AtLeast:
+    case ExpressionKind::Exactly: {
+      // pushed in reverse so the operands are folded, and their values stacked, in list order
+      stack.push_back({e, true});
+      usize first = stack.size();
+      for (Expression *list = e->cardinality.operands; list; list = list->binary.right) {
+        stack.push_back({list->binary.left, false});
+      }
+      std::reverse(stack.begin() + (std::ptrdiff_t)first, stack.end());
+      break;
+    }
+    default: values.push_back(e); break;
+    }
+  }
+  return values.back();
+}
+
+// Blocks in an order where every block comes after the blocks and loop instructions that lead to it
+std::vector<BasicBlock *> topological_order(CFG *cfg) {
+  std::vector<BasicBlock *> order;
+  std::vector<bool> visited((u32)cfg->block_count, false);
+  struct Pending {
+    BasicBlock *bb;
+    u32 next_successor;
+  };
+  std::vector<Pending> stack;
+  auto successor = [](BasicBlock *bb, u32 index) -> BasicBlock * {
+    for (auto &inst : bb->insts) {
+      if (inst.kind != InstructionKind::Loop) continue;
+      if (index-- == 0) return inst.loop.inner_bb;
+    }
+    switch (bb->terminator_kind) {
+    case TerminatorKind::Goto: return index == 0 ? bb->go.goto_bb : nullptr;
+    case TerminatorKind::Branch: return index == 0 ? bb->branch.then_bb : index == 1 ? bb->branch.else_bb : nullptr;
+    default: return nullptr;
+    }
+  };
+
+  visited[(u32)cfg->entry_bb->id] = true;
+  stack.push_back({cfg->entry_bb, 0});
+  while (stack.size()) {
+    Pending &top     = stack.back();
+    BasicBlock *next = successor(top.bb, top.next_successor++);
+    if (!next) {
+      order.push_back(top.bb);
+      stack.pop_back();
+    } else if (!visited[(u32)next->id]) {
+      visited[(u32)next->id] = true;
+      stack.push_back({next, 0});
+    }
+  }
+  return {order.rbegin(), order.rend()};
+}
+
+void merge_bindings(Folder *f, BasicBlock *bb, const std::vector<Expression *> &bindings) {
+  std::vector<Expression *> &entry = f->entry_bindings[(u32)bb->id];
+  if (!f->reached[(u32)bb->id]) {
+    f->reached[(u32)bb->id] = true;
+    entry                   = bindings;
+    return;
+  }
+  for (u32 i = 0; i < entry.size(); ++i) {
+    if (entry[i] != bindings[i]) entry[i] = &f->conflict;
+  }
+}
+
+// Gives the blocks that are still reachable dense ids again, so the translator only sizes its tables for them
+void renumber_blocks(CFG *cfg) {
+  std::vector<BasicBlock *> order = topological_order(cfg);
+  for (u32 i = 0; i < order.size(); ++i) order[i]->id = (i32)i;
+  cfg->block_count = (i32)order.size();
+}
+
+void optimize_cfg(CFG *cfg) {
+  Folder folder;
+  Folder *f           = &folder;
+  f->cfg              = cfg;
+  f->false_expression = new_expression(f, ExpressionKind::False);
+  f->true_expression  = new_expression(f, ExpressionKind::True);
+  f->conflict.kind    = ExpressionKind::None;
+  f->entry_bindings.resize((u32)cfg->block_count);
+  f->reached.resize((u32)cfg->block_count, false);
+  f->resolving.resize((u32)cfg->local_variable_count, false);
+  f->local_values.resize((u32)cfg->local_variable_count, nullptr);
+  f->local_stamps.resize((u32)cfg->local_variable_count, 0);
+  f->block_stamp = 0;
+
+  merge_bindings(f, cfg->entry_bb, std::vector<Expression *>((u32)cfg->local_variable_count, nullptr));
+  std::vector<bool> bound_here((u32)cfg->local_variable_count);
+  for (BasicBlock *bb : topological_order(cfg)) {
+    if (!f->reached[(u32)bb->id]) continue;
+    std::vector<Expression *> bindings = std::move(f->entry_bindings[(u32)bb->id]);
+    ++f->block_stamp;
+
+    // the first assignment to a variable in a block is the one that binds it
+    std::fill(bound_here.begin(), bound_here.end(), false);
+    for (auto &inst : bb->insts) {
+      switch (inst.kind) {
+      case InstructionKind::Assign: {
+        Expression *&value = inst.assign.right_value_expression;
+        value              = fold_expression(f, value, nullptr);
+        if (bound_here[(u32)inst.assign.localvar]) break;
+        bound_here[(u32)inst.assign.localvar] = true;
+        bindings[(u32)inst.assign.localvar]   = value;
+        break;
+      }
+      case InstructionKind::Loop: merge_bindings(f, inst.loop.inner_bb, bindings); break;
+      default: assert(!"Unreachable"); break;
+      }
+    }
+
+    switch (bb->terminator_kind) {
+    case TerminatorKind::Goto: merge_bindings(f, bb->go.goto_bb, bindings); break;
+    case TerminatorKind::Branch: {
+      Expression *condition = fold_expression(f, bb->branch.condition_expression, &bindings);
+      if (is_constant(condition)) {
+        BasicBlock *taken   = condition->kind == ExpressionKind::True ? bb->branch.then_bb : bb->branch.else_bb;
+        bb->terminator_kind = TerminatorKind::Goto;
+        bb->go.goto_bb      = taken;
+        merge_bindings(f, taken, bindings);
+        break;
+      }
+      bb->branch.condition_expression = condition;
+      merge_bindings(f, bb->branch.then_bb, bindings);
+      merge_bindings(f, bb->branch.else_bb, bindings);
+      break;
+    }
+    case TerminatorKind::Return:
+      bb->ret.return_expression = fold_expression(f, bb->ret.return_expression, &bindings);
+      break;
+    default: break;
+    }
+  }
+
+  renumber_blocks(cfg);
+}
+
+} // namespace slang
@@ -0,0 +1,73 @@
+#ifndef CLAUSE_DATABASE_HPP
+#define CLAUSE_DATABASE_HPP
+
+#include "general.hpp"
+#include <initializer_list>
+#include <vector>
+
+namespace slang {
+
+struct Clause {
+  const int *first;
+  const int *last;
+
+  const int *begin() const { return first; }
+  const int *end() const { return last; }
+  usize size() const { return (usize)(last - first); }
+};
+
+// Receives clauses one at a time, in the order they are produced
+struct ClauseSink {
+  virtual ~ClauseSink() = default;
+
+  virtual void add_clause(const int *literals, usize count) = 0;
+
+  void add_clause(std::initializer_list<int> clause) { add_clause(clause.begin(), clause.size()); }
+};
+
+// Append-only CNF stored in compressed sparse row form: the literals of every clause live back to back in one buffer
+// and clause i spans literals[offsets[i]] up to literals[offsets[i + 1]]. A clause is built by pushing its literals
+// and then calling end_clause, so adding a clause never allocates on its own.
+struct ClauseDatabase : ClauseSink {
+  std::vector<int> literals;
+  std::vector<usize> offsets{0};
+  i32 max_variable = 0;
+
+  void push_literal(int literal) {
+    assert(literal != 0); // 0 is not a valid variable
+    i32 variable = literal < 0 ? -literal : literal;
+    if (variable > max_variable) max_variable = variable;
+    literals.push_back(literal);
+  }
+
+  void end_clause() { offsets.push_back(literals.size()); }
+
+  using ClauseSink::add_clause;
+
+  void add_clause(const int *clause, usize count) override {
+    for (usize i = 0; i < count; ++i) push_literal(clause[i]);
+    end_clause();
+  }
+
+  // Keeps the capacity, so a buffer that is filled again does not allocate
+  void clear() {
+    literals.clear();
+    offsets.assign(1, 0);
+    max_variable = 0;
+  }
+
+  void reserve(usize clause_count, usize literal_count) {
+    offsets.reserve(clause_count + 1);
+    literals.reserve(literal_count);
+  }
+
+  usize clause_count() const { return offsets.size() - 1; }
+
+  Clause clause(usize index) const {
+    return {literals.data() + offsets[index], literals.data() + offsets[index + 1]};
+  }
+};
+
+} // namespace slang
+
+#endif
@@ -0,0 +1,50 @@
+#include "clause_dedup.hpp"
+
+#include <algorithm>
+
+namespace slang {
+
+DeduplicatingSink::DeduplicatingSink(ClauseSink *sink)
+    : sink(sink), index(0, ClauseHash{this}, ClauseEqual{this}) {}
+
+bool DeduplicatingSink::ClauseEqual::operator()(usize a, usize b) const {
+  Clause left  = owner->forwarded.clause(a);
+  Clause right = owner->forwarded.clause(b);
+  return left.size() == right.size() && std::equal(left.begin(), left.end(), right.begin());
+}
+
+u32 literal_order(int literal) { return (u32)(literal < 0 ? -literal : literal) << 1 | (literal < 0); }
+
+void DeduplicatingSink::add_clause(const int *literals, usize count) {
+  // the clause is normalised at the end of forwarded and taken off again if it was seen before
+  usize first = forwarded.literals.size();
+  for (usize i = 0; i < count; ++i) forwarded.literals.push_back(literals[i]);
+  auto begin = forwarded.literals.begin() + (std::ptrdiff_t)first;
+  std::sort(begin, forwarded.literals.end(), [](int a, int b) { return literal_order(a) < literal_order(b); });
+  forwarded.literals.erase(std::unique(begin, forwarded.literals.end()), forwarded.literals.end());
+
+  u64 hash = forwarded.literals.size() - first;
+  for (usize i = first; i < forwarded.literals.size(); ++i) {
+    if (i > first && forwarded.literals[i] == -forwarded.literals[i - 1]) {
+      forwarded.literals.resize(first);
+      ++tautology_count;
+      return;
+    }
+    hash = (hash ^ (u32)forwarded.literals[i]) * 0x100000001b3;
+  }
+
+  usize clause = forwarded.clause_count();
+  forwarded.end_clause();
+  hashes.push_back(hash);
+  if (!index.insert(clause).second) {
+    forwarded.offsets.pop_back();
+    forwarded.literals.resize(first);
+    hashes.pop_back();
+    ++duplicate_count;
+    return;
+  }
+  Clause normalised = forwarded.clause(clause);
+  sink->add_clause(normalised.begin(), normalised.size());
+}
+
+} // namespace slang
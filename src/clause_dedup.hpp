@@ -0,0 +1,45 @@
+#ifndef CLAUSE_DEDUP_HPP
+#define CLAUSE_DEDUP_HPP
+
+#include "clause_database.hpp"
+#include "general.hpp"
+#include <unordered_set>
+#include <vector>
+
+namespace slang {
+
+// Normalises clauses and forwards every distinct one to sink once. Literals are sorted by variable with the positive
+// literal first and repeated literals are dropped, tautologies are not forwarded at all. The clauses that were
+// forwarded are kept in normalised form and found again through a hash set of their indices, so the sink holds the
+// whole CNF in memory.
+struct DeduplicatingSink : ClauseSink {
+  explicit DeduplicatingSink(ClauseSink *sink);
+
+  DeduplicatingSink(const DeduplicatingSink &) = delete;
+  DeduplicatingSink &operator=(const DeduplicatingSink &) = delete;
+
+  ClauseSink *sink;
+  u64 duplicate_count = 0;
+  u64 tautology_count = 0;
+
+  using ClauseSink::add_clause;
+  void add_clause(const int *literals, usize count) override;
+
+private:
+  struct ClauseHash {
+    const DeduplicatingSink *owner;
+    usize operator()(usize clause) const { return owner->hashes[clause]; }
+  };
+  struct ClauseEqual {
+    const DeduplicatingSink *owner;
+    bool operator()(usize a, usize b) const;
+  };
+
+  ClauseDatabase forwarded;
+  std::vector<u64> hashes;
+  std::unordered_set<usize, ClauseHash, ClauseEqual> index;
+};
+
+} // namespace slang
+
+#endif
@@ -0,0 +1,359 @@
+#include "compile_cache.hpp"
+
+#include "binary_cnf.hpp"
+#include "clause_dedup.hpp"
+
+#include <algorithm>
+#include <errno.h>
+#include <unordered_map>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace slang {
+
+const u64 cache_version = 1;
+
+u64 finalize(u64 value) {
+  value ^= value >> 33;
+  value *= 0xff51afd7ed558ccd;
+  value ^= value >> 33;
+  value *= 0xc4ceb9fe1a85ec53;
+  value ^= value >> 33;
+  return value;
+}
+
+// The two halves are mixed with different multipliers so they do not collide together
+void mix(Digest *digest, u64 value) {
+  digest->low  = finalize((digest->low ^ value) * 0x87c37b91114253d5);
+  digest->high = finalize((digest->high + value) * 0x4cf5ad432745937f ^ (digest->high >> 29));
+}
+
+void mix(Digest *digest, const Digest &value) {
+  mix(digest, value.low);
+  mix(digest, value.high);
+}
+
+struct DigestHash {
+  usize operator()(const Digest &digest) const { return digest.low; }
+};
+
+std::string to_hex(const Digest &digest) {
+  char hex[33];
+  snprintf(hex, sizeof(hex), "%016llx%016llx", (unsigned long long)digest.high, (unsigned long long)digest.low);
+  return hex;
+}
+
+bool from_hex(cstr hex, Digest *out_digest) {
+  unsigned long long high, low;
+  if (strlen(hex) != 32 || sscanf(hex, "%16llx%16llx", &high, &low) != 2) return false;
+  out_digest->high = high;
+  out_digest->low  = low;
+  return true;
+}
+
+std::string cache_path(const CompileCache &cache, const std::string &name, cstr extension) {
+  return cache.directory + "/" + name + extension;
+}
+
+bool file_exists(const std::string &path) {
+  struct stat file_stat;
+  return stat(path.c_str(), &file_stat) == 0;
+}
+
+// Files are written under a name of their own and renamed into place, so a concurrent compilation never sees half
+// of one
+std::string temporary_path(const std::string &path) { return path + ".tmp" + std::to_string(getpid()); }
+
+Result commit_file(const std::string &temporary, const std::string &path, bool written) {
+  if (!written || rename(temporary.c_str(), path.c_str())) {
+    error("could not write %s\n", path.c_str());
+    remove(temporary.c_str());
+    return err;
+  }
+  return ok;
+}
+
+// Reads the manifest and the pack of the compilation named name, err if either is missing or they do not match
+Result load_compilation(const CompileCache &cache, const std::string &name, i32 *out_variable_count,
+                        std::vector<CachedConstraint> *out_constraints, ClauseDatabase *out_pack) {
+  FILE *file = fopen(cache_path(cache, name, ".manifest").c_str(), "r");
+  if (!file) return err;
+  unsigned long long version;
+  u32 count;
+  bool valid = fscanf(file, "slang-cache %llu %d %u", &version, out_variable_count, &count) == 3 &&
+               version == cache_version;
+  out_constraints->clear();
+  for (u32 i = 0; valid && i < count; ++i) {
+    char hex[33];
+    unsigned long long first_clause, clause_count;
+    CachedConstraint constraint;
+    valid = fscanf(file, "%32s %d %d %llu %llu", hex, &constraint.max_literal, &constraint.max_variable,
+                   &first_clause, &clause_count) == 5 &&
+            from_hex(hex, &constraint.key);
+    constraint.first_clause = first_clause;
+    constraint.clause_count = clause_count;
+    out_constraints->push_back(constraint);
+  }
+  fclose(file);
+  if (!valid) return err;
+
+  BinaryCnf pack;
+  std::string pack_path = cache_path(cache, name, ".cnfb");
+  if (!file_exists(pack_path) || pack.open(pack_path.c_str()) || pack.load(out_pack)) return err;
+  for (const CachedConstraint &constraint : *out_constraints) {
+    if (constraint.first_clause > out_pack->clause_count() ||
+        constraint.clause_count > out_pack->clause_count() - constraint.first_clause) {
+      error("corrupt cache manifest %s, deleting %s clears the cache\n", name.c_str(), cache.directory.c_str());
+      return err;
+    }
+  }
+  return ok;
+}
+
+Result store_compilation(const CompileCache &cache) {
+  std::string name      = to_hex(cache.source_key);
+  std::string pack_path = cache_path(cache, name, ".cnfb");
+  std::string temporary = temporary_path(pack_path);
+  if (commit_file(temporary, pack_path, !output_binary_cnf(cache.pack, temporary.c_str()))) return err;
+
+  std::string manifest_path = cache_path(cache, name, ".manifest");
+  temporary                 = temporary_path(manifest_path);
+  FILE *file                = fopen(temporary.c_str(), "w");
+  bool written              = file;
+  if (file) {
+    fprintf(file, "slang-cache %llu %d %zu\n", (unsigned long long)cache_version, cache.variable_count,
+            cache.constraints.size());
+    for (const CachedConstraint &constraint : cache.constraints) {
+      fprintf(file, "%s %d %d %llu %llu\n", to_hex(constraint.key).c_str(), constraint.max_literal,
+              constraint.max_variable, (unsigned long long)constraint.first_clause,
+              (unsigned long long)constraint.clause_count);
+    }
+    written = !fclose(file);
+  }
+  if (commit_file(temporary, manifest_path, written)) return err;
+
+  // the compilation of a file is found through a link named after its path, which holds the name of the manifest
+  if (cache.file_key.empty()) return ok;
+  std::string link_path = cache_path(cache, cache.file_key, ".last");
+  temporary             = temporary_path(link_path);
+  file                  = fopen(temporary.c_str(), "w");
+  written               = file && fprintf(file, "%s\n", name.c_str()) > 0;
+  if (file && fclose(file)) written = false;
+  return commit_file(temporary, link_path, written);
+}
+
+Digest hash_bytes(Digest digest, const char *bytes, usize length) {
+  mix(&digest, (u64)length);
+  for (usize i = 0; i < length; i += 8) {
+    u64 chunk = 0;
+    memcpy(&chunk, bytes + i, std::min((usize)8, length - i));
+    mix(&digest, chunk);
+  }
+  return digest;
+}
+
+Result open_cache(cstr directory, cstr filepath, const char *source, i32 source_length, const CnfOptions &options,
+                  CompileCache *out_cache) {
+  if (mkdir(directory, 0777) && errno != EEXIST) {
+    error("could not create cache directory %s\n", directory);
+    return err;
+  }
+  out_cache->directory = directory;
+  out_cache->encoding  = options.encoding;
+
+  Digest key;
+  mix(&key, cache_version);
+  mix(&key, (u64)options.encoding);
+  out_cache->source_key = hash_bytes(key, source, (usize)source_length);
+
+  out_cache->file_key.clear();
+  if (char *path = strcmp(filepath, "-") ? realpath(filepath, nullptr) : nullptr) {
+    out_cache->file_key = to_hex(hash_bytes(key, path, strlen(path)));
+    free(path);
+  }
+
+  out_cache->has_manifest = !load_compilation(*out_cache, to_hex(out_cache->source_key), &out_cache->variable_count,
+                                              &out_cache->constraints, &out_cache->pack);
+  return ok;
+}
+
+// Passes the clauses of every constraint in the pack on, with the auxiliary variables of each constraint moved to
+// follow the ones of the constraint before it. Deduplication runs over all of them, so it is the only part of the
+// options that is not in the keys.
+void forward_constraints(const CompileCache &cache, ClauseSink *sink, const CnfOptions &options,
+                         CnfStats *out_stats) {
+  std::unique_ptr<DeduplicatingSink> deduplicated;
+  if (options.deduplicate) {
+    deduplicated.reset(new DeduplicatingSink(sink));
+    sink = deduplicated.get();
+  }
+
+  i32 max_literal = 0;
+  for (const CachedConstraint &constraint : cache.constraints) {
+    max_literal = std::max(max_literal, constraint.max_literal);
+  }
+  i32 next_variable = max_literal + 1;
+  std::vector<int> clause;
+  for (const CachedConstraint &constraint : cache.constraints) {
+    i32 shift = next_variable - (constraint.max_literal + 1);
+    for (u64 i = constraint.first_clause; i < constraint.first_clause + constraint.clause_count; ++i) {
+      clause.clear();
+      for (int literal : cache.pack.clause((usize)i)) {
+        int variable = literal < 0 ? -literal : literal;
+        if (variable > constraint.max_literal) variable += shift;
+        clause.push_back(literal < 0 ? -variable : variable);
+      }
+      sink->add_clause(clause.data(), clause.size());
+    }
+    if (constraint.max_variable > constraint.max_literal) {
+      next_variable += constraint.max_variable - constraint.max_literal;
+    }
+  }
+
+  if (out_stats) {
+    out_stats->auxiliary_variables += (u64)(next_variable - (max_literal + 1));
+    if (deduplicated) {
+      out_stats->duplicate_clauses += deduplicated->duplicate_count;
+      out_stats->tautologies += deduplicated->tautology_count;
+    }
+  }
+}
+
+Result replay_cnf(CompileCache *cache, ClauseSink *sink, const CnfOptions &options, CnfStats *out_stats) {
+  assert(cache->has_manifest);
+  cache->reused_blocks += cache->constraints.size();
+  forward_constraints(*cache, sink, options, out_stats);
+  return ok;
+}
+
+void append_clauses(const ClauseDatabase &from, u64 first_clause, u64 clause_count, ClauseDatabase *to) {
+  for (u64 i = first_clause; i < first_clause + clause_count; ++i) {
+    Clause clause = from.clause((usize)i);
+    to->add_clause(clause.begin(), clause.size());
+  }
+}
+
+// Copies the subtree of expression into scratch, copies maps the ids of table to nodes of scratch and is reset for
+// the nodes that were copied before returning
+SAT_Expression *copy_subtree(const SAT_Expression *expression, SAT_ExpressionTable *scratch,
+                             std::vector<SAT_Expression *> &copies) {
+  std::vector<const SAT_Expression *> stack{expression};
+  std::vector<i32> copied;
+  auto copy_of = [&copies](const SAT_Expression *node) {
+    return node ? copies[(usize)node->id] : nullptr;
+  };
+  while (!stack.empty()) {
+    const SAT_Expression *node = stack.back();
+    if (copies[(usize)node->id]) {
+      stack.pop_back();
+      continue;
+    }
+    bool pending = false;
+    for (const SAT_Expression *child : {node->leftChild, node->rightChild}) {
+      if (child && !copies[(usize)child->id]) {
+        stack.push_back(child);
+        pending = true;
+      }
+    }
+    if (pending) continue;
+    stack.pop_back();
+    copies[(usize)node->id] = scratch->copy(node, copy_of(node->leftChild), copy_of(node->rightChild));
+    copied.push_back(node->id);
+  }
+  SAT_Expression *copy = copies[(usize)expression->id];
+  for (i32 id : copied) copies[(usize)id] = nullptr;
+  return copy;
+}
+
+Result cached_to_cnf(CompileCache *cache, const SAT_ExpressionTable &table, const SAT_Expression *expression,
+                     i32 variable_count, ClauseSink *sink, const CnfOptions &options, CnfStats *out_stats) {
+  // Merkle hash and largest literal of every node, children have smaller ids than their parents
+  std::vector<Digest> digests((usize)table.size());
+  std::vector<i32> max_literals((usize)table.size(), 0);
+  for (i32 id = 0; id < table.size(); ++id) {
+    const SAT_Expression *node = table.at(id);
+    Digest digest;
+    mix(&digest, (u64)node->op);
+    if (node->isLiteral()) max_literals[(usize)id] = node->literal;
+    if (node->isLiteral() || node->op == Operator::ATMOST) mix(&digest, (u64)(u32)node->literal);
+    for (const SAT_Expression *child : {node->leftChild, node->rightChild}) {
+      if (!child) {
+        mix(&digest, ~0ull);
+        continue;
+      }
+      mix(&digest, digests[(usize)child->id]);
+      max_literals[(usize)id] = std::max(max_literals[(usize)id], max_literals[(usize)child->id]);
+    }
+    digests[(usize)id] = digest;
+  }
+
+  // the constraints are the operands of the AND nodes at the top, from left to right and each one once
+  std::vector<const SAT_Expression *> constraints;
+  std::vector<bool> seen((usize)table.size(), false);
+  std::vector<const SAT_Expression *> stack{expression};
+  while (!stack.empty()) {
+    const SAT_Expression *node = stack.back();
+    stack.pop_back();
+    if (seen[(usize)node->id]) continue;
+    seen[(usize)node->id] = true;
+    if (node->op == Operator::AND) {
+      stack.push_back(node->rightChild);
+      stack.push_back(node->leftChild);
+    } else {
+      constraints.push_back(node);
+    }
+  }
+
+  // constraints of the last compilation of the file, found by their key
+  i32 previous_variable_count;
+  std::vector<CachedConstraint> previous;
+  ClauseDatabase previous_pack;
+  std::unordered_map<Digest, usize, DigestHash> previous_index;
+  char name[33];
+  FILE *link = cache->file_key.empty() ? nullptr : fopen(cache_path(*cache, cache->file_key, ".last").c_str(), "r");
+  if (link) {
+    if (fscanf(link, "%32s", name) == 1 &&
+        !load_compilation(*cache, name, &previous_variable_count, &previous, &previous_pack)) {
+      for (usize i = 0; i < previous.size(); ++i) previous_index.emplace(previous[i].key, i);
+    }
+    fclose(link);
+  }
+
+  cache->constraints.clear();
+  cache->pack           = ClauseDatabase();
+  cache->variable_count = variable_count;
+  SAT_ExpressionTable scratch;
+  std::vector<SAT_Expression *> copies((usize)table.size(), nullptr);
+  CnfOptions block_options  = options;
+  block_options.deduplicate = false;
+  for (const SAT_Expression *constraint : constraints) {
+    CachedConstraint cached;
+    mix(&cached.key, cache_version);
+    mix(&cached.key, (u64)cache->encoding);
+    mix(&cached.key, digests[(usize)constraint->id]);
+    cached.max_literal  = max_literals[(usize)constraint->id];
+    cached.first_clause = cache->pack.clause_count();
+
+    auto found = previous_index.find(cached.key);
+    if (found != previous_index.end()) {
+      const CachedConstraint &reused = previous[found->second];
+      cached.max_variable            = reused.max_variable;
+      append_clauses(previous_pack, reused.first_clause, reused.clause_count, &cache->pack);
+      ++cache->reused_blocks;
+    } else {
+      // converting a copy keeps the work proportional to the constraint instead of to the whole table
+      scratch.clear();
+      ClauseDatabase block = to_cnf(scratch, copy_subtree(constraint, &scratch, copies), block_options);
+      cached.max_variable  = block.max_variable;
+      append_clauses(block, 0, block.clause_count(), &cache->pack);
+      ++cache->compiled_blocks;
+    }
+    cached.clause_count = cache->pack.clause_count() - cached.first_clause;
+    cache->constraints.push_back(cached);
+  }
+
+  forward_constraints(*cache, sink, options, out_stats);
+  return store_compilation(*cache);
+}
+
+} // namespace slang
@@ -0,0 +1,73 @@
+#ifndef COMPILE_CACHE_HPP
+#define COMPILE_CACHE_HPP
+
+#include "clause_database.hpp"
+#include "general.hpp"
+#include "sat_syntax_tree.hpp"
+#include "tseitin_transform.hpp"
+#include <string>
+#include <vector>
+
+namespace slang {
+
+// 128 bit content hash. It is not cryptographic, the cache trusts whoever can write to its directory.
+struct Digest {
+  u64 low  = 0x6a09e667f3bcc908;
+  u64 high = 0xbb67ae8584caa73b;
+
+  bool operator==(const Digest &other) const { return low == other.low && high == other.high; }
+};
+
+// A constraint of a compilation and where its clauses are in the pack. Variables up to max_literal are the grid
+// variables it reads, the ones above are its own auxiliary variables numbered from max_literal + 1, which are
+// renumbered when the clauses are passed on.
+struct CachedConstraint {
+  Digest key;
+  i32 max_literal;
+  i32 max_variable;
+  u64 first_clause;
+  u64 clause_count;
+};
+
+// On-disk cache of compiled CNF in a directory. The top-level conjuncts of the formula, the constraints, are
+// converted to CNF one at a time and each is keyed by a Merkle hash of its subtree. A compilation stores the clauses
+// of all its constraints back to back in a pack, a binary CNF, and lists the constraints in a manifest, both named
+// after the hash of the source and the options. The next compilation of the same source does not even parse it,
+// and the next one of the same file after an edit converts only the constraints that are not in the pack of the
+// compilation before it.
+//
+// The clauses come out the same whether they are cached or not, but they differ from to_cnf on the whole formula:
+// constraints that share a subformula each get their own auxiliary variables for it. Bump cache_version in
+// compile_cache.cpp whenever generate_sat or to_cnf produce different output. Nothing is ever deleted from the
+// directory, removing it clears the cache.
+struct CompileCache {
+  std::string directory;
+  Digest source_key;
+  std::string file_key; // names the manifest of the last compilation of the file, empty for stdin
+  CnfEncoding::Enum encoding;
+
+  // set by open_cache when the manifest and the pack of the source are in the cache
+  bool has_manifest  = false;
+  i32 variable_count = 0;
+  std::vector<CachedConstraint> constraints;
+  ClauseDatabase pack;
+
+  u64 reused_blocks   = 0;
+  u64 compiled_blocks = 0;
+};
+
+// Creates directory if needed, hashes the source and loads its manifest and pack if they exist
+Result open_cache(cstr directory, cstr filepath, const char *source, i32 source_length, const CnfOptions &options,
+                  CompileCache *out_cache);
+
+// Passes the clauses of a source that has a manifest to sink
+Result replay_cnf(CompileCache *cache, ClauseSink *sink, const CnfOptions &options, CnfStats *out_stats = nullptr);
+
+// Like to_cnf, but reuses the clauses of constraints the last compilation of the file had and stores the pack and
+// the manifest of this one. variable_count is recorded in the manifest for callers that skip parsing.
+Result cached_to_cnf(CompileCache *cache, const SAT_ExpressionTable &table, const SAT_Expression *expression,
+                     i32 variable_count, ClauseSink *sink, const CnfOptions &options, CnfStats *out_stats = nullptr);
+
+} // namespace slang
+
+#endif
@@ -0,0 +1,268 @@
+#include "dimacs.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace slang {
+
+// Enough room for a "p cnf" line with any i32 variable count and u64 clause count after a comment line of at least
+// "c\n", which pads the header to its reserved length
+const usize header_variable_width = 10;
+const usize header_clause_width   = 20;
+const usize header_line_length    = sizeof("p cnf ") - 1 + header_variable_width + 1 + header_clause_width + 1;
+const usize header_length         = 2 + header_line_length;
+
+const usize flush_threshold = 1 << 20;
+
+// Longest formatted literal is "-2147483648 "
+const usize max_literal_length = 12;
+
+const char digit_pairs[] = "00010203040506070809"
+                           "10111213141516171819"
+                           "20212223242526272829"
+                           "30313233343536373839"
+                           "40414243444546474849"
+                           "50515253545556575859"
+                           "60616263646566676869"
+                           "70717273747576777879"
+                           "80818283848586878889"
+                           "90919293949596979899";
+
+// Writes the decimal digits of value ending right before end, two digits at a time, and returns the first digit
+char *format_u64_backwards(char *end, u64 value) {
+  while (value >= 100) {
+    u64 pair = (value % 100) * 2;
+    value /= 100;
+    *--end = digit_pairs[pair + 1];
+    *--end = digit_pairs[pair];
+  }
+  if (value >= 10) {
+    *--end = digit_pairs[value * 2 + 1];
+    *--end = digit_pairs[value * 2];
+  } else {
+    *--end = (char)('0' + value);
+  }
+  return end;
+}
+
+char *format_int(char *out, int value) {
+  u64 magnitude = value < 0 ? (u64)(-(i64)value) : (u64)value;
+  if (value < 0) *out++ = '-';
+
+  char digits[20];
+  char *end   = digits + sizeof(digits);
+  char *start = format_u64_backwards(end, magnitude);
+  memcpy(out, start, (usize)(end - start));
+  return out + (end - start);
+}
+
+// Fills header with a blank comment line followed by a canonical "p cnf V C" line, strict parsers reject any other
+// spacing in the latter
+void format_header(char *header, i32 variable_count, u64 clause_count) {
+  char *line = header + header_length;
+  *--line    = '\n';
+  line       = format_u64_backwards(line, clause_count);
+  *--line    = ' ';
+  line       = format_u64_backwards(line, (u64)variable_count);
+  line -= sizeof("p cnf ") - 1;
+  memcpy(line, "p cnf ", sizeof("p cnf ") - 1);
+
+  header[0] = 'c';
+  memset(header + 1, ' ', (usize)(line - header) - 2);
+  line[-1] = '\n';
+}
+
+Result flush(DimacsWriter *writer) {
+  if (fwrite(writer->buffer.data(), 1, writer->buffer_length, writer->file) != writer->buffer_length) {
+    error("failed to write dimacs output\n");
+    return err;
+  }
+  writer->buffer_length = 0;
+  return ok;
+}
+
+DimacsWriter::~DimacsWriter() {
+  if (file) fclose(file);
+}
+
+Result DimacsWriter::open(cstr filepath) {
+  file = fopen(filepath, "wb");
+  if (!file) {
+    error("could not open file for writing: %s\n", filepath);
+    return err;
+  }
+  buffer.resize(flush_threshold + max_literal_length * 64);
+
+  // Reserve the header, it is patched with the final counts once every clause is written
+  format_header(buffer.data(), 0, 0);
+  buffer_length = header_length;
+  return ok;
+}
+
+void DimacsWriter::add_clause(const int *literals, usize count) {
+  if (buffer.size() - buffer_length < (count + 1) * max_literal_length) {
+    if (flush(this)) panic("could not write clause to dimacs output\n");
+    if (buffer.size() < (count + 1) * max_literal_length) buffer.resize((count + 1) * max_literal_length);
+  }
+
+  char *out = buffer.data() + buffer_length;
+  for (usize i = 0; i < count; ++i) {
+    i32 variable = literals[i] < 0 ? -literals[i] : literals[i];
+    assert(variable != 0); // 0 is not a valid variable
+    if (variable > max_variable) max_variable = variable;
+
+    out    = format_int(out, literals[i]);
+    *out++ = ' ';
+  }
+  *out++ = '0'; // Terminate the clause with '0'
+  *out++ = '\n';
+  buffer_length = (usize)(out - buffer.data());
+  ++clause_count;
+
+  if (buffer_length >= flush_threshold && flush(this)) panic("could not write clause to dimacs output\n");
+}
+
+Result DimacsWriter::close() {
+  assert(file);
+  Result result = flush(this);
+
+  char header[header_length];
+  format_header(header, max_variable, clause_count);
+
+  if (!result && (fseek(file, 0, SEEK_SET) || fwrite(header, 1, header_length, file) != header_length)) {
+    error("failed to write dimacs header\n");
+    result = err;
+  }
+  if (fclose(file)) result = err;
+  file = nullptr;
+  return result;
+}
+
+Result output_dimacs(const ClauseDatabase &cnf, cstr filepath) {
+  DimacsWriter writer;
+  if (writer.open(filepath)) return err;
+  for (usize i = 0; i < cnf.clause_count(); ++i) {
+    Clause clause = cnf.clause(i);
+    writer.add_clause(clause.begin(), clause.size());
+  }
+  // variables that no longer occur in any clause still count, so models keep their size
+  if (cnf.max_variable > writer.max_variable) writer.max_variable = cnf.max_variable;
+  return writer.close();
+}
+
+bool is_dimacs_space(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+
+const char *skip_line(const char *in, const char *end) {
+  while (in < end && *in != '\n') ++in;
+  return in;
+}
+
+// Parses a decimal integer at *in, returns false if there is none or it does not fit in an i32
+bool parse_int(const char **in, const char *end, i64 *out_value) {
+  const char *at = *in;
+  bool negative  = at < end && *at == '-';
+  if (negative) ++at;
+  if (at == end || *at < '0' || *at > '9') return false;
+  i64 value = 0;
+  for (; at < end && '0' <= *at && *at <= '9'; ++at) {
+    value = value * 10 + (*at - '0');
+    if (value > INT32_MAX) return false;
+  }
+  *in        = at;
+  *out_value = negative ? -value : value;
+  return true;
+}
+
+Result parse_dimacs(const char *in, const char *end, ClauseDatabase *out_cnf) {
+  i32 line            = 1;
+  bool clause_started = false;
+  while (in < end) {
+    char c = *in;
+    if (is_dimacs_space(c)) {
+      line += c == '\n';
+      ++in;
+      continue;
+    }
+    if (c == 'c') {
+      in = skip_line(in, end);
+      continue;
+    }
+    if (c == '%') break; // end marker of the SATLIB benchmarks
+    if (c == 'p') {
+      i64 variable_count = 0, clause_count = 0;
+      const char *at     = in + 1;
+      while (at < end && is_dimacs_space(*at) && *at != '\n') ++at;
+      if (end - at < 3 || memcmp(at, "cnf", 3)) {
+        error("line %d: expected p cnf header\n", line);
+        return err;
+      }
+      at += 3;
+      while (at < end && is_dimacs_space(*at) && *at != '\n') ++at;
+      bool valid = parse_int(&at, end, &variable_count);
+      while (at < end && is_dimacs_space(*at) && *at != '\n') ++at;
+      if (!valid || !parse_int(&at, end, &clause_count) || variable_count < 0 || clause_count < 0) {
+        error("line %d: expected variable and clause count in p cnf header\n", line);
+        return err;
+      }
+      if (variable_count > out_cnf->max_variable) out_cnf->max_variable = (i32)variable_count;
+      // a clause takes at least two bytes, so a wrong count cannot make this reserve more than the file needs
+      usize max_clauses = (usize)(end - at) / 2;
+      out_cnf->reserve((usize)clause_count < max_clauses ? (usize)clause_count : max_clauses, 0);
+      in = skip_line(at, end);
+      continue;
+    }
+
+    i64 literal;
+    if (!parse_int(&in, end, &literal) || literal == INT32_MIN) {
+      error("line %d: expected literal\n", line);
+      return err;
+    }
+    if (literal == 0) {
+      out_cnf->end_clause();
+      clause_started = false;
+    } else {
+      out_cnf->push_literal((int)literal);
+      clause_started = true;
+    }
+  }
+  // the 0 after the last clause is optional in practice
+  if (clause_started) out_cnf->end_clause();
+  return ok;
+}
+
+Result read_dimacs(cstr filepath, ClauseDatabase *out_cnf) {
+  out_cnf->literals.clear();
+  out_cnf->offsets.assign(1, 0);
+  out_cnf->max_variable = 0;
+
+  int fd = open(filepath, O_RDONLY);
+  if (fd < 0) {
+    error("could not open file %s\n", filepath);
+    return err;
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat)) {
+    error("could not read file %s\n", filepath);
+    close(fd);
+    return err;
+  }
+  if (file_stat.st_size == 0) {
+    close(fd);
+    return ok;
+  }
+  void *mapping = mmap(nullptr, (usize)file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    error("could not map file %s\n", filepath);
+    return err;
+  }
+  madvise(mapping, (usize)file_stat.st_size, MADV_SEQUENTIAL);
+  const char *data = (const char *)mapping;
+  Result result    = parse_dimacs(data, data + file_stat.st_size, out_cnf);
+  munmap(mapping, (usize)file_stat.st_size);
+  return result;
+}
+
+} // namespace slang
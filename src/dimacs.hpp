@@ -0,0 +1,40 @@
+#ifndef DIMACS_HPP
+#define DIMACS_HPP
+
+#include "clause_database.hpp"
+#include "general.hpp"
+#include <vector>
+
+namespace slang {
+
+// Writes clauses in DIMACS format as they arrive instead of collecting them first. Literals are formatted into a
+// large buffer that is flushed whenever it fills up, and the "p cnf" header is written as a fixed length placeholder
+// which close() overwrites with the final variable and clause counts, padded by a comment line in front of it. The
+// output therefore has to be seekable.
+struct DimacsWriter : ClauseSink {
+  FILE *file = nullptr;
+  std::vector<char> buffer;
+  usize buffer_length = 0;
+
+  i32 max_variable = 0;
+  u64 clause_count = 0;
+
+  ~DimacsWriter() override;
+
+  Result open(cstr filepath);
+
+  using ClauseSink::add_clause;
+  void add_clause(const int *literals, usize count) override;
+
+  Result close();
+};
+
+Result output_dimacs(const ClauseDatabase &cnf, cstr filepath);
+
+// Reads a DIMACS file into out_cnf, which is cleared first. Comment lines are skipped and out_cnf->max_variable is
+// at least the variable count of the "p cnf" line.
+Result read_dimacs(cstr filepath, ClauseDatabase *out_cnf);
+
+} // namespace slang
+
+#endif
@@ -1,39 +1,273 @@
 #include "general.hpp"
 
+#include "binary_cnf.hpp"
 #include "cfg.hpp"
+#include "compile_cache.hpp"
+#include "dimacs.hpp"
 #include "parser.hpp"
+#include "preprocess.hpp"
+#include "solver.hpp"
+#include "stats.hpp"
+#include "thread_pool.hpp"
 #include "tseitin_transform.hpp"
 
-int main(int argc, char **argv) {
-  if (argc != 2) {
-    error("expected argument for file name");
-    return err;
+const char usage[] = "usage: sat-lang [--encoding tseitin|pg] [--threads n] [--dedup] [--preprocess] [--solve] "
+                     "[--format dimacs|binary] [--cache directory] [--stats human|json] <file | ->\n";
+
+// Looks name up in the names of a DECLARE_KIND enum, what names the option in the error message
+template <class Enum>
+Result parse_kind(cstr what, cstr name, const cstr *names, i32 count, Enum *out_kind) {
+  for (i32 i = 0; i < count; ++i) {
+    if (!strcmp(name, names[i])) {
+      *out_kind = (Enum)i;
+      return ok;
+    }
   }
+  error("unknown %s %s\n", what, name);
+  return err;
+}
+
+// Prints the value of every grid variable as DIMACS "v" lines
+void print_model(const std::vector<bool> &model, i32 variable_count) {
+  const i32 literals_per_line = 16;
+  for (i32 variable = 1; variable <= variable_count; ++variable) {
+    if ((variable - 1) % literals_per_line == 0) printf("v");
+    bool value = (usize)variable < model.size() && model[(usize)variable];
+    printf(" %d", value ? variable : -variable);
+    if (variable % literals_per_line == 0) printf("\n");
+  }
+  if (variable_count % literals_per_line == 0) printf("v");
+  printf(" 0\n");
+}
+
+struct Options {
+  cstr filepath = nullptr;
+  slang::CnfOptions cnf;
+  bool solve                    = false;
+  bool preprocess               = false;
+  slang::CnfFormat::Enum format = slang::CnfFormat::Dimacs;
+  cstr cache_directory          = nullptr;
+};
+
+cstr output_path(slang::CnfFormat::Enum format) {
+  return format == slang::CnfFormat::Binary ? "output.cnfb" : "output.dimacs";
+}
 
+// clauses are formatted while they are generated, so to_cnf includes writing them out
+template <class Writer, class EmitCnf>
+Result write_cnf(const Options &options, EmitCnf emit_cnf, slang::Stats *stats) {
+  u64 start = slang::now_ns();
+  Writer writer;
+  if (writer.open(output_path(options.format))) return err;
+  slang::end_phase(stats, slang::Phase::OutputDimacs, start);
+
+  start = slang::now_ns();
+  slang::CnfStats cnf_stats;
+  if (emit_cnf(&writer, &cnf_stats)) return err;
+  slang::end_phase(stats, slang::Phase::ToCnf, start);
+  stats->auxiliary_variables = cnf_stats.auxiliary_variables;
+  stats->duplicate_clauses   = cnf_stats.duplicate_clauses;
+  stats->tautologies         = cnf_stats.tautologies;
+  stats->clauses             = writer.clause_count;
+
+  start = slang::now_ns();
+  if (writer.close()) return err;
+  slang::end_phase(stats, slang::Phase::OutputDimacs, start);
+  debug("wrote %d variables and %llu clauses to %s, dropped %llu duplicate clauses and %llu tautologies\n",
+        writer.max_variable, (unsigned long long)writer.clause_count, output_path(options.format),
+        (unsigned long long)cnf_stats.duplicate_clauses, (unsigned long long)cnf_stats.tautologies);
+  return ok;
+}
+
+Result compile(const Options &options, slang::Stats *stats) {
   slang::CFG cfg;
-  if (slang::parse_to_cfg(&cfg, argv[1])) return err;
+  u64 start = slang::now_ns();
+  if (slang::load_source(&cfg, options.filepath)) return err;
+  stats->source_bytes = (u64)cfg.file_length;
 
-  slang::dump_cfg(&cfg);
+  // a source the cache has a manifest for is not parsed at all
+  slang::CompileCache cache;
+  if (options.cache_directory && slang::open_cache(options.cache_directory, options.filepath, cfg.file_data,
+                                                   cfg.file_length, options.cnf, &cache)) {
+    return err;
+  }
+  slang::end_phase(stats, slang::Phase::Read, start);
 
-  auto *sat_expression = slang::generate_sat(&cfg);
-  sat_expression->display();
-  std::cout << std::endl;
+  SAT_ExpressionTable table;
+  SAT_Expression *sat_expression = nullptr;
+  i32 variable_count             = cache.variable_count;
+  if (!cache.has_manifest) {
+    if (slang::parse_source(&cfg, stats)) return err;
+    stats->tokens       = (u64)cfg.token_count;
+    stats->basic_blocks = (u64)cfg.block_count;
+    variable_count      = cfg.variable_count;
 
-  SAT_Expression *expression3 = new SAT_Expression(Operator::AND, new SAT_Expression(3), new SAT_Expression(1));
-  SAT_Expression expression_combined3(Operator::AND, expression3, new SAT_Expression(2));
+    start = slang::now_ns();
+    slang::optimize_cfg(&cfg);
+    slang::end_phase(stats, slang::Phase::Cfg, start);
+    stats->reachable_blocks = (u64)cfg.block_count;
 
-  std::vector<std::vector<int>> clauses = slang::to_cnf(sat_expression);
-  slang::output_dimacs(clauses, "output.dimacs");
+    start = slang::now_ns();
+    slang::dump_cfg(&cfg);
+    slang::end_phase(stats, slang::Phase::Dump, start);
 
-  std::cout << "CNF:\n";
-  for (const auto &row : clauses) {
-    // Print each element of the row with spaces
-    for (const auto &element : row) {
-      std::cout << element << " ";
-    }
-    // Print a newline after each row
+    start          = slang::now_ns();
+    sat_expression = slang::generate_sat(&cfg, &table, options.cnf.pool);
+    slang::end_phase(stats, slang::Phase::GenerateSat, start);
+    stats->sat_nodes    = (u64)table.size();
+    stats->table_hits   = table.hits();
+    stats->table_misses = table.misses();
+
+    start = slang::now_ns();
+    sat_expression->display();
     std::cout << std::endl;
+    slang::end_phase(stats, slang::Phase::Dump, start);
   }
+  stats->grid_variables = (u64)variable_count;
 
-  return ok;
+  auto emit_cnf = [&](slang::ClauseSink *sink, slang::CnfStats *cnf_stats) {
+    Result result = ok;
+    if (cache.has_manifest) {
+      result = slang::replay_cnf(&cache, sink, options.cnf, cnf_stats);
+    } else if (options.cache_directory) {
+      result = slang::cached_to_cnf(&cache, table, sat_expression, variable_count, sink, options.cnf, cnf_stats);
+    } else {
+      slang::to_cnf(table, sat_expression, sink, options.cnf, cnf_stats);
+    }
+    stats->cached_blocks   = cache.reused_blocks;
+    stats->compiled_blocks = cache.compiled_blocks;
+    return result;
+  };
+
+  if (options.solve || options.preprocess) {
+    slang::CnfStats cnf_stats;
+    slang::ClauseDatabase cnf;
+    start = slang::now_ns();
+    if (emit_cnf(&cnf, &cnf_stats)) return err;
+    slang::end_phase(stats, slang::Phase::ToCnf, start);
+    stats->auxiliary_variables = cnf_stats.auxiliary_variables;
+    stats->duplicate_clauses   = cnf_stats.duplicate_clauses;
+    stats->tautologies         = cnf_stats.tautologies;
+    stats->clauses             = cnf.clause_count();
+
+    // grid variables are frozen so the simplified CNF still talks about every cell of the grids
+    slang::ClauseDatabase reconstruction;
+    if (options.preprocess) {
+      start = slang::now_ns();
+      slang::ClauseDatabase simplified;
+      auto preprocess_stats = slang::preprocess(cnf, variable_count, &simplified, &reconstruction);
+      debug("preprocessing fixed %llu variables (%llu failed literals), eliminated %llu variables, removed %llu "
+            "subsumed clauses and strengthened %llu, %zu of %zu clauses left\n",
+            (unsigned long long)preprocess_stats.fixed_variables, (unsigned long long)preprocess_stats.failed_literals,
+            (unsigned long long)preprocess_stats.eliminated_variables,
+            (unsigned long long)preprocess_stats.subsumed_clauses,
+            (unsigned long long)preprocess_stats.strengthened_clauses, simplified.clause_count(), cnf.clause_count());
+      cnf = std::move(simplified);
+      slang::end_phase(stats, slang::Phase::Preprocess, start);
+      stats->clauses = cnf.clause_count();
+    }
+
+    if (!options.solve) {
+      start         = slang::now_ns();
+      Result result = options.format == slang::CnfFormat::Binary
+                          ? slang::output_binary_cnf(cnf, output_path(options.format))
+                          : slang::output_dimacs(cnf, output_path(options.format));
+      slang::end_phase(stats, slang::Phase::OutputDimacs, start);
+      return result;
+    }
+
+    start = slang::now_ns();
+    std::vector<bool> model;
+    auto result = slang::solve(cnf, &model);
+    slang::end_phase(stats, slang::Phase::Solve, start);
+    printf("s %s\n", slang::SolveResult::to_string[result]);
+    if (result == slang::SolveResult::Satisfiable) {
+      slang::extend_model(reconstruction, &model);
+      print_model(model, variable_count);
+    }
+    return ok;
+  }
+
+  if (options.format == slang::CnfFormat::Binary) return write_cnf<slang::BinaryCnfWriter>(options, emit_cnf, stats);
+  return write_cnf<slang::DimacsWriter>(options, emit_cnf, stats);
+}
+
+int main(int argc, char **argv) {
+  Options options;
+  bool show_stats                       = false;
+  slang::StatsFormat::Enum stats_format = slang::StatsFormat::Human;
+  for (i32 i = 1; i < argc; ++i) {
+    cstr arg = argv[i];
+    if (!strcmp(arg, "--encoding")) {
+      if (i + 1 == argc) {
+        error("expected encoding name after --encoding\n");
+        return err;
+      }
+      if (parse_kind("encoding", argv[++i], slang::CnfEncoding::to_string, slang::CnfEncoding::NumItems,
+                     &options.cnf.encoding)) {
+        return err;
+      }
+    } else if (!strcmp(arg, "--threads")) {
+      if (i + 1 == argc || (options.cnf.thread_count = atoi(argv[++i])) < 1) {
+        error("expected a positive thread count after --threads\n");
+        return err;
+      }
+    } else if (!strcmp(arg, "--dedup")) {
+      options.cnf.deduplicate = true;
+    } else if (!strcmp(arg, "--preprocess")) {
+      options.preprocess = true;
+    } else if (!strcmp(arg, "--solve")) {
+      options.solve = true;
+    } else if (!strcmp(arg, "--format")) {
+      if (i + 1 == argc) {
+        error("expected dimacs or binary after --format\n");
+        return err;
+      }
+      if (parse_kind("output format", argv[++i], slang::CnfFormat::to_string, slang::CnfFormat::NumItems,
+                     &options.format)) {
+        return err;
+      }
+    } else if (!strcmp(arg, "--cache")) {
+      if (i + 1 == argc) {
+        error("expected cache directory after --cache\n");
+        return err;
+      }
+      options.cache_directory = argv[++i];
+    } else if (!strcmp(arg, "--stats")) {
+      if (i + 1 == argc) {
+        error("expected human or json after --stats\n");
+        return err;
+      }
+      if (parse_kind("stats format", argv[++i], slang::StatsFormat::to_string, slang::StatsFormat::NumItems,
+                     &stats_format)) {
+        return err;
+      }
+      show_stats = true;
+    } else if (arg[0] == '-' && arg[1] == '-') {
+      error("unknown option %s\n%s", arg, usage);
+      return err;
+    } else if (options.filepath) {
+      error("expected only one file name but found %s\n%s", arg, usage);
+      return err;
+    } else {
+      options.filepath = arg;
+    }
+  }
+  if (!options.filepath) {
+    error("expected argument for file name\n%s", usage);
+    return err;
+  }
+
+  // one pool serves generate_sat and to_cnf, with a single thread it has no threads of its own
+  slang::ThreadPool pool(options.cnf.thread_count);
+  options.cnf.pool = &pool;
+
+  // stats go to stderr since stdout carries the CFG, the SAT expression and the model
+  slang::Stats stats;
+  Result result = compile(options, &stats);
+  if (show_stats) {
+    stats.peak_rss_kib = slang::peak_rss_kib();
+    slang::print_stats(stats, stats_format, stderr);
+  }
+  return result;
 }
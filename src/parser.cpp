@@ -1,7 +1,14 @@
 #include "parser.hpp"
 #include "cfg.hpp"
 
-#include <string>
+#include <algorithm>
+#include <fcntl.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <unordered_map>
 
 namespace slang {
@@ -14,6 +21,9 @@ namespace slang {
   pick(Not,      "!"), \
   pick(And,      "&&"), \
   pick(Or,       "||"), \
+  pick(Xor,      "^"), \
+  pick(Equal,    "=="), \
+  pick(Comma,    ","), \
   pick(LCurl,    "{"), \
   pick(RCurl,    "}"), \
   pick(LParen,   "("), \
@@ -31,6 +41,9 @@ namespace slang {
   pick(For,      "for"), \
   pick(In,       "in"), \
   pick(Return,   "return"), \
+  pick(ExactlyOne, "exactly_one"), \
+  pick(AtMost,   "at_most"), \
+  pick(AtLeast,  "at_least"), \
   pick(Err,      "'error'"), \
   pick(Eof,      "'end of file'"),
 DECLARE_KIND(TOKEN_KIND, TokenKind);
@@ -45,29 +58,39 @@ struct Token {
   };
 };
 
-struct Property {
-  std::vector<Span> values;
-};
-
 struct Grid {
   std::vector<i32> dimensions;
   i32 variable_start_index;
 };
 
+// A distinct identifier of the source and what it names, -1 for every kind it does not name
+struct Symbol {
+  Span name;
+  u32 hash;
+
+  i32 property;
+  i32 grid;
+  i32 local_variable;
+  i32 index_variable;
+};
+
 struct Parser {
-  std::unordered_map<std::string, i32> property_map;
-  std::vector<Property> properties;
+  // symbols by id, symbol_slots is an open addressing hash table of symbol ids keyed on the identifier text
+  std::vector<Symbol> symbols;
+  std::vector<i32> symbol_slots;
+
+  i32 property_count;
+  // value index by (property id << 32 | value symbol id)
+  std::unordered_map<u64, i32> property_values;
 
   i32 variable_count;
-  std::unordered_map<std::string, Grid> grids;
+  std::vector<Grid> grids;
 
   i32 local_variable_count;
-  std::unordered_map<std::string, i32> local_variable_map;
-
   i32 index_variable_count;
-  std::unordered_map<std::string, i32> index_variable_map;
 
   i32 block_count;
+  i32 token_count;
 
   i32 index;
   i32 tlength;
@@ -76,19 +99,53 @@ struct Parser {
 
   Token token;
 
-  char *data;
+  const char *data;
   i32 file_length;
+
+  // set for the operands of cardinality constraints, which may be grid slices
+  bool allow_slices;
+
+  Pool<Expression> *expressions;
+  Pool<BasicBlock> *blocks;
 };
 
-bool is_span_equal(Parser *p, Span span1, Span span2) {
-  if (span1.length != span2.length) return false;
-  for (i32 i = 0; i < span1.length; ++i) {
-    if (p->data[span1.index + i] != p->data[span2.index + i]) return false;
+u32 hash_span(Parser *p, Span span) {
+  u32 hash = 2166136261u;
+  for (i32 i = 0; i < span.length; ++i) hash = (hash ^ (u8)p->data[span.index + i]) * 16777619u;
+  return hash;
+}
+
+void grow_symbol_slots(Parser *p) {
+  usize capacity = p->symbol_slots.empty() ? 256 : p->symbol_slots.size() * 2;
+  p->symbol_slots.assign(capacity, -1);
+  for (i32 id = 0; id < (i32)p->symbols.size(); ++id) {
+    usize slot = p->symbols[(u32)id].hash & (capacity - 1);
+    while (p->symbol_slots[slot] >= 0) slot = (slot + 1) & (capacity - 1);
+    p->symbol_slots[slot] = id;
   }
-  return true;
 }
 
-std::string span_to_string(Parser *p, Span span) { return std::string(&p->data[span.index], (u32)span.length); }
+// Returns the dense id of the identifier at span, giving it the next id the first time its text is seen
+i32 intern(Parser *p, Span span) {
+  if (p->symbols.size() * 2 >= p->symbol_slots.size()) grow_symbol_slots(p);
+
+  u32 hash   = hash_span(p, span);
+  usize mask = p->symbol_slots.size() - 1;
+  for (usize slot = hash & mask;; slot = (slot + 1) & mask) {
+    i32 id = p->symbol_slots[slot];
+    if (id < 0) {
+      id                    = (i32)p->symbols.size();
+      p->symbol_slots[slot] = id;
+      p->symbols.push_back({span, hash, -1, -1, -1, -1});
+      return id;
+    }
+    Span name = p->symbols[(u32)id].name;
+    if (p->symbols[(u32)id].hash == hash && name.length == span.length &&
+        !memcmp(&p->data[name.index], &p->data[span.index], (u32)span.length)) {
+      return id;
+    }
+  }
+}
 
 bool is_whitespace(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
 
@@ -108,6 +165,7 @@ void end_token(Parser *p) {
 }
 
 Token *create_token(Parser *p, TokenKind::Enum kind) {
+  ++p->token_count;
   p->token.kind         = kind;
   p->token.line         = p->line;
   p->token.value.index  = p->index;
@@ -121,6 +179,177 @@ char peek_char(Parser *p) {
   return p->data[p->index + p->tlength];
 }
 
+// The vector scanners classify a whole chunk of source bytes per step. Each returns the index of the first byte that
+// ends the run, or the index where less than a chunk is left, and the scalar loops in skip_whitespace, scan_identifier
+// and scan_integer finish the run from there. They match the scalar classification exactly, bytes outside of ASCII
+// are negative as signed chars and therefore never fall inside the compared ranges.
+#if defined(__x86_64__)
+i32 skip_whitespace_sse2(const char *data, i32 index, i32 length, i32 *lines) {
+  for (; index + 16 <= length; index += 16) {
+    __m128i chunk   = _mm_loadu_si128((const __m128i *)(data + index));
+    __m128i newline = _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\n'));
+    __m128i space =
+        _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\t')));
+    space = _mm_or_si128(space, _mm_or_si128(newline, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\r'))));
+    u32 space_mask   = (u32)_mm_movemask_epi8(space);
+    u32 newline_mask = (u32)_mm_movemask_epi8(newline);
+    if (space_mask != 0xffff) {
+      u32 run = (u32)__builtin_ctz(~space_mask);
+      *lines += __builtin_popcount(newline_mask & ((1u << run) - 1));
+      return index + (i32)run;
+    }
+    *lines += __builtin_popcount(newline_mask);
+  }
+  return index;
+}
+
+__m128i in_range_sse2(__m128i chunk, char first, char last) {
+  return _mm_and_si128(_mm_cmpgt_epi8(chunk, _mm_set1_epi8((char)(first - 1))),
+                       _mm_cmplt_epi8(chunk, _mm_set1_epi8((char)(last + 1))));
+}
+
+i32 scan_identifier_sse2(const char *data, i32 index, i32 length) {
+  for (; index + 16 <= length; index += 16) {
+    __m128i chunk  = _mm_loadu_si128((const __m128i *)(data + index));
+    __m128i letter = in_range_sse2(_mm_or_si128(chunk, _mm_set1_epi8(0x20)), 'a', 'z');
+    __m128i word   = _mm_or_si128(letter, in_range_sse2(chunk, '0', '9'));
+    word           = _mm_or_si128(word, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('_')));
+    u32 word_mask  = (u32)_mm_movemask_epi8(word);
+    if (word_mask != 0xffff) return index + __builtin_ctz(~word_mask);
+  }
+  return index;
+}
+
+i32 scan_integer_sse2(const char *data, i32 index, i32 length) {
+  for (; index + 16 <= length; index += 16) {
+    __m128i chunk  = _mm_loadu_si128((const __m128i *)(data + index));
+    __m128i digit  = _mm_or_si128(in_range_sse2(chunk, '0', '9'), _mm_cmpeq_epi8(chunk, _mm_set1_epi8('_')));
+    u32 digit_mask = (u32)_mm_movemask_epi8(digit);
+    if (digit_mask != 0xffff) return index + __builtin_ctz(~digit_mask);
+  }
+  return index;
+}
+
+__attribute__((target("avx2"))) i32 skip_whitespace_avx2(const char *data, i32 index, i32 length, i32 *lines) {
+  for (; index + 32 <= length; index += 32) {
+    __m256i chunk   = _mm256_loadu_si256((const __m256i *)(data + index));
+    __m256i newline = _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('\n'));
+    __m256i space   = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(' ')),
+                                      _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('\t')));
+    space = _mm256_or_si256(space, _mm256_or_si256(newline, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('\r'))));
+    u32 space_mask   = (u32)_mm256_movemask_epi8(space);
+    u32 newline_mask = (u32)_mm256_movemask_epi8(newline);
+    if (space_mask != 0xffffffff) {
+      u32 run = (u32)__builtin_ctz(~space_mask);
+      *lines += __builtin_popcount(newline_mask & ((1u << run) - 1));
+      return index + (i32)run;
+    }
+    *lines += __builtin_popcount(newline_mask);
+  }
+  return index;
+}
+
+__attribute__((target("avx2"))) __m256i in_range_avx2(__m256i chunk, char first, char last) {
+  return _mm256_and_si256(_mm256_cmpgt_epi8(chunk, _mm256_set1_epi8((char)(first - 1))),
+                          _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(last + 1)), chunk));
+}
+
+__attribute__((target("avx2"))) i32 scan_identifier_avx2(const char *data, i32 index, i32 length) {
+  for (; index + 32 <= length; index += 32) {
+    __m256i chunk  = _mm256_loadu_si256((const __m256i *)(data + index));
+    __m256i letter = in_range_avx2(_mm256_or_si256(chunk, _mm256_set1_epi8(0x20)), 'a', 'z');
+    __m256i word   = _mm256_or_si256(letter, in_range_avx2(chunk, '0', '9'));
+    word           = _mm256_or_si256(word, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('_')));
+    u32 word_mask  = (u32)_mm256_movemask_epi8(word);
+    if (word_mask != 0xffffffff) return index + __builtin_ctz(~word_mask);
+  }
+  return index;
+}
+
+__attribute__((target("avx2"))) i32 scan_integer_avx2(const char *data, i32 index, i32 length) {
+  for (; index + 32 <= length; index += 32) {
+    __m256i chunk  = _mm256_loadu_si256((const __m256i *)(data + index));
+    __m256i digit  = _mm256_or_si256(in_range_avx2(chunk, '0', '9'), _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('_')));
+    u32 digit_mask = (u32)_mm256_movemask_epi8(digit);
+    if (digit_mask != 0xffffffff) return index + __builtin_ctz(~digit_mask);
+  }
+  return index;
+}
+#endif
+
+LexerMode::Enum detect_lexer_mode() {
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return LexerMode::Avx2;
+  return LexerMode::Sse2;
+#else
+  return LexerMode::Scalar;
+#endif
+}
+
+LexerMode::Enum lexer_mode = detect_lexer_mode();
+
+void set_lexer_mode(LexerMode::Enum mode) { lexer_mode = mode; }
+
+// Most runs are only a few bytes long, so the scalar loop looks at the first scalar_prefix bytes of a run by itself
+// and the vector scanners only take over for runs that are longer than that
+const i32 scalar_prefix = 8;
+
+void skip_whitespace(Parser *p) {
+  i32 index = p->index;
+  i32 end   = std::min(index + scalar_prefix, p->file_length);
+  for (; index < end && is_whitespace(p->data[index]); ++index) {
+    if (p->data[index] == '\n') p->line++;
+  }
+#if defined(__x86_64__)
+  if (index == end) {
+    switch (lexer_mode) {
+    case LexerMode::Avx2: index = skip_whitespace_avx2(p->data, index, p->file_length, &p->line); break;
+    case LexerMode::Sse2: index = skip_whitespace_sse2(p->data, index, p->file_length, &p->line); break;
+    default: break;
+    }
+  }
+#endif
+  for (; index < p->file_length && is_whitespace(p->data[index]); ++index) {
+    if (p->data[index] == '\n') p->line++;
+  }
+  p->index = index;
+}
+
+bool is_identifier_char(char c) { return is_letter_or_underscore(c) || is_number(c); }
+
+i32 scan_identifier(Parser *p, i32 index) {
+  i32 end = std::min(index + scalar_prefix, p->file_length);
+  while (index < end && is_identifier_char(p->data[index])) ++index;
+#if defined(__x86_64__)
+  if (index == end) {
+    switch (lexer_mode) {
+    case LexerMode::Avx2: index = scan_identifier_avx2(p->data, index, p->file_length); break;
+    case LexerMode::Sse2: index = scan_identifier_sse2(p->data, index, p->file_length); break;
+    default: break;
+    }
+  }
+#endif
+  while (index < p->file_length && is_identifier_char(p->data[index])) ++index;
+  return index;
+}
+
+i32 scan_integer(Parser *p, i32 index) {
+  i32 end = std::min(index + scalar_prefix, p->file_length);
+  while (index < end && is_number_or_underscore(p->data[index])) ++index;
+#if defined(__x86_64__)
+  if (index == end) {
+    switch (lexer_mode) {
+    case LexerMode::Avx2: index = scan_integer_avx2(p->data, index, p->file_length); break;
+    case LexerMode::Sse2: index = scan_integer_sse2(p->data, index, p->file_length); break;
+    default: break;
+    }
+  }
+#endif
+  while (index < p->file_length && is_number_or_underscore(p->data[index])) ++index;
+  return index;
+}
+
 // clang-format off
 TokenKind::Enum keywords[] {
   TokenKind::False,
@@ -133,15 +362,15 @@ TokenKind::Enum keywords[] {
   TokenKind::For,
   TokenKind::In,
   TokenKind::Return,
+  TokenKind::ExactlyOne,
+  TokenKind::AtMost,
+  TokenKind::AtLeast,
 };
 const i32 num_keywords = sizeof(keywords) / sizeof(TokenKind::Enum);
 // clang-format on
 
 Token *next_keyword_or_identifier(Parser *p) {
-  while (char ch = peek_char(p)) {
-    if (!is_letter_or_underscore(ch) && !is_number(ch)) break;
-    ++p->tlength;
-  }
+  p->tlength = scan_identifier(p, p->index + p->tlength) - p->index;
 
   for (i32 i = 0; i < num_keywords; ++i) {
     cstr ptr = TokenKind::to_string[keywords[i]];
@@ -158,10 +387,10 @@ Token *next_keyword_or_identifier(Parser *p) {
 }
 
 Token *next_integer(Parser *p) {
+  i32 end = scan_integer(p, p->index + p->tlength);
   u64 val = 0;
-  while (char c = peek_char(p)) {
-    if (!c || !is_number_or_underscore(c)) break;
-    ++p->tlength;
+  for (; p->index + p->tlength < end; ++p->tlength) {
+    char c = p->data[p->index + p->tlength];
     if (c != '_') val = val * 10 + (u8)(c - '0');
   }
   auto *token   = create_token(p, TokenKind::Intlit);
@@ -170,14 +399,19 @@ Token *next_integer(Parser *p) {
 }
 
 Token *next(Parser *p) {
-  while (is_whitespace(peek_char(p))) {
-    if (peek_char(p) == '\n') p->line++;
-    p->index++;
-  }
+  skip_whitespace(p);
 
   switch (char c = peek_char(p)) {
   case '.': ++p->tlength; return create_token(p, TokenKind::Dot);
-  case '=': ++p->tlength; return create_token(p, TokenKind::Assign);
+  case '=':
+    ++p->tlength;
+    if (peek_char(p) == '=') {
+      ++p->tlength;
+      return create_token(p, TokenKind::Equal);
+    }
+    return create_token(p, TokenKind::Assign);
+  case '^': ++p->tlength; return create_token(p, TokenKind::Xor);
+  case ',': ++p->tlength; return create_token(p, TokenKind::Comma);
   case '!': ++p->tlength; return create_token(p, TokenKind::Not);
   case '&':
     ++p->tlength;
@@ -226,7 +460,36 @@ Token *peek(Parser *p) { return &p->token; }
 
 bool check_peek(Parser *p, TokenKind::Enum kind) { return peek(p)->kind == kind; }
 
-bool is_span_equal_cstr(char *file_data, Span span, cstr str) {
+Result lex(const char *data, i32 length, std::vector<LexedToken> *out_tokens) {
+  Parser lexer;
+  lexer.index       = 0;
+  lexer.tlength     = 0;
+  lexer.line        = 1;
+  lexer.token_count = 0;
+  lexer.data        = data;
+  lexer.file_length = length;
+  for (;;) {
+    Token *token = next(&lexer);
+    if (!token) return err;
+
+    if (out_tokens) {
+      LexedToken lexed;
+      lexed.kind   = token->kind;
+      lexed.line   = token->line;
+      lexed.value  = token->value;
+      lexed.intlit = 0;
+      if (token->kind == TokenKind::Intlit) {
+        // the literal shares its storage with the start of the span
+        lexed.value.index = lexer.index - token->value.length;
+        lexed.intlit      = token->intlit;
+      }
+      out_tokens->push_back(lexed);
+    }
+    if (token->kind == TokenKind::Eof) return ok;
+  }
+}
+
+bool is_span_equal_cstr(const char *file_data, Span span, cstr str) {
   for (i32 i = 0; i < span.length; ++i) {
     if (*str == '\0') return false;
     if (file_data[span.index + i] != *str) return false;
@@ -236,46 +499,89 @@ bool is_span_equal_cstr(char *file_data, Span span, cstr str) {
 }
 
 Expression *parse_expression(Parser *p);
+Expression *parse_cardinality(Parser *p);
+
+struct SlicedIndex {
+  Expression *index_expression;
+  i32 dimension_size;
+};
+
+// Expands the grid reference at reference, whose sliced indices are placeholders, into a List of a reference for
+// every combination of values of the sliced indices. The last sliced index changes fastest.
+Expression *expand_slice(Parser *p, Expression *reference, const std::vector<SlicedIndex> &sliced) {
+  // the chain from the outermost index in to the grid, which every copy shares
+  std::vector<Expression *> chain;
+  for (; reference->kind == ExpressionKind::Index; reference = reference->index.inner) chain.push_back(reference);
+
+  std::vector<i32> values(sliced.size(), 0);
+  Expression *list  = nullptr;
+  Expression **tail = &list;
+  for (;;) {
+    for (u32 i = 0; i < sliced.size(); ++i) sliced[i].index_expression->index.constant_index = values[i];
+    Expression *cell = reference;
+    for (u32 i = (u32)chain.size(); i-- > 0;) {
+      Expression *index_expression  = p->expressions->make();
+      *index_expression             = *chain[i];
+      index_expression->index.inner = cell;
+      cell                          = index_expression;
+    }
+    Expression *element   = p->expressions->make();
+    element->kind         = ExpressionKind::List;
+    element->binary.left  = cell;
+    element->binary.right = nullptr;
+    *tail                 = element;
+    tail                  = &element->binary.right;
+
+    u32 position = (u32)sliced.size();
+    while (position > 0 && ++values[position - 1] == sliced[position - 1].dimension_size) values[--position] = 0;
+    if (position == 0) return list;
+  }
+}
 
 Expression *parse_operand(Parser *p) {
+  bool allow_slices = p->allow_slices;
+  p->allow_slices   = false;
+
   switch (peek(p)->kind) {
   case TokenKind::False: {
     if (!next(p)) return nullptr; // next false
 
-    Expression *false_expression = new Expression();
+    Expression *false_expression = p->expressions->make();
     false_expression->kind       = ExpressionKind::False;
     return false_expression;
   }
   case TokenKind::True: {
     if (!next(p)) return nullptr; // next true
 
-    Expression *true_expression = new Expression();
+    Expression *true_expression = p->expressions->make();
     true_expression->kind       = ExpressionKind::True;
     return true_expression;
   }
   case TokenKind::Not: {
     if (!next(p)) return nullptr; // next !
 
-    Expression *not_expression  = new Expression();
+    Expression *not_expression  = p->expressions->make();
     not_expression->kind        = ExpressionKind::Not;
     not_expression->unary.inner = parse_operand(p);
     if (!not_expression->unary.inner) return nullptr;
     return not_expression;
   }
   case TokenKind::Ident: {
-    std::string name_string = span_to_string(p, peek(p)->value);
+    Span name  = peek(p)->value;
+    i32 symbol = intern(p, name);
     if (!next(p)) return nullptr; // next 'ident'
 
     if (peek(p)->kind == TokenKind::LSquare) {
-      if (p->grids.find(name_string) == p->grids.end()) {
-        error("line %d: unknown grid with name %s\n", p->line, name_string.c_str());
+      i32 grid = p->symbols[(u32)symbol].grid;
+      if (grid < 0) {
+        error("line %d: unknown grid with name %.*s\n", p->line, name.length, &p->data[name.index]);
         return nullptr;
       }
-      Grid *grid_ptr = &p->grids[name_string];
+      Grid *grid_ptr = &p->grids[(u32)grid];
 
       i32 expected_dimensions = (i32)grid_ptr->dimensions.size();
 
-      Expression *grid_ref          = new Expression();
+      Expression *grid_ref          = p->expressions->make();
       grid_ref->kind                = ExpressionKind::GridRef;
       grid_ref->grid_start_variable = grid_ptr->variable_start_index;
 
@@ -283,6 +589,7 @@ Expression *parse_operand(Parser *p) {
 
       i32 accumulated_dimension_size = 1;
       i32 dimension_index            = 0;
+      std::vector<SlicedIndex> sliced;
       for (;;) {
         if (check_peek(p, TokenKind::Err)) return nullptr;
         if (!check_peek(p, TokenKind::LSquare)) break;
@@ -293,63 +600,69 @@ Expression *parse_operand(Parser *p) {
           return nullptr;
         }
 
-        Expression *index_expression           = new Expression();
+        Expression *index_expression           = p->expressions->make();
         index_expression->kind                 = ExpressionKind::Index;
         index_expression->index.dimension_size = accumulated_dimension_size;
         index_expression->index.inner          = result;
         result                                 = index_expression;
 
         switch (peek(p)->kind) {
+        case TokenKind::RSquare:
+          // an empty index is a slice over the whole dimension, expanded once the reference is complete
+          if (!allow_slices) {
+            error("line %d: grid slices are only allowed as operands of cardinality constraints\n", p->line);
+            return nullptr;
+          }
+          index_expression->index.constant_index = 0;
+          index_expression->index.is_constant    = true;
+          sliced.push_back({index_expression, grid_ptr->dimensions[(u32)dimension_index]});
+          break;
         case TokenKind::Intlit:
           index_expression->index.constant_index = peek(p)->intlit;
           index_expression->index.is_constant    = true;
           if (!next(p)) return nullptr; // next 'intlit'
           break;
         case TokenKind::Ident: {
-          Span index_name               = peek(p)->value;
-          std::string index_name_string = span_to_string(p, index_name);
+          Span index_name  = peek(p)->value;
+          i32 index_symbol = intern(p, index_name);
           if (!next(p)) return nullptr; // next 'intlit'
 
           if (check_peek(p, TokenKind::Dot)) {
             if (!next(p)) return nullptr; // next .
 
-            auto it = p->property_map.find(index_name_string);
-            if (it == p->property_map.end()) {
-              error("line %d: could not find property %s\n", p->line, index_name_string.c_str());
+            i32 property = p->symbols[(u32)index_symbol].property;
+            if (property < 0) {
+              error("line %d: could not find property %.*s\n", p->line, index_name.length,
+                    &p->data[index_name.index]);
               return nullptr;
             }
 
-            Property *property = &p->properties[(u32)it->second];
-
             if (!check_peek(p, TokenKind::Ident)) {
               error("line %d: expected property value name after .", p->line);
               return nullptr;
             }
-            Span value_name               = peek(p)->value;
-            std::string value_name_string = span_to_string(p, value_name);
+            Span value_name = peek(p)->value;
+            i32 value       = intern(p, value_name);
             if (!next(p)) return nullptr; // next 'ident'
 
-            for (i32 i = 0; i < (i32)property->values.size(); ++i) {
-              if (is_span_equal(p, value_name, property->values[(u32)i])) {
-                index_expression->index.constant_index = i;
-                break;
-              }
-            }
-            if (index_expression->index.constant_index == -1) {
-              error("line %d: could not find value %s in property %s \n", p->line, value_name_string.c_str(),
-                    index_name_string.c_str());
+            auto it = p->property_values.find((u64)property << 32 | (u32)value);
+            if (it == p->property_values.end()) {
+              error("line %d: could not find value %.*s in property %.*s \n", p->line, value_name.length,
+                    &p->data[value_name.index], index_name.length, &p->data[index_name.index]);
               return nullptr;
             }
-            index_expression->index.is_constant = true;
+            index_expression->index.constant_index = it->second;
+            index_expression->index.is_constant    = true;
           } else {
 
-            auto it = p->index_variable_map.find(index_name_string);
-            if (it == p->index_variable_map.end()) {
-              error("line %d: could not find index variable %s\n", p->line, index_name_string.c_str());
+            i32 indexvar = p->symbols[(u32)index_symbol].index_variable;
+            if (indexvar < 0) {
+              error("line %d: could not find index variable %.*s\n", p->line, index_name.length,
+                    &p->data[index_name.index]);
               return nullptr;
             }
 
-            index_expression->index.indexvar    = it->second;
+            index_expression->index.indexvar    = indexvar;
             index_expression->index.is_constant = false;
           }
           break;
@@ -379,21 +692,25 @@ Expression *parse_operand(Parser *p) {
         return nullptr;
       }
 
+      if (sliced.size()) return expand_slice(p, result, sliced);
       return result;
     } else {
-      Expression *lvar_expression = new Expression();
+      Expression *lvar_expression = p->expressions->make();
       lvar_expression->kind       = ExpressionKind::LVar;
 
-      auto it = p->local_variable_map.find(name_string);
-      if (it == p->local_variable_map.end()) {
-        error("line %d: could not find local variable definition for %s\n", p->line, name_string.c_str());
+      lvar_expression->lvar = p->symbols[(u32)symbol].local_variable;
+      if (lvar_expression->lvar < 0) {
+        error("line %d: could not find local variable definition for %.*s\n", p->line, name.length,
+              &p->data[name.index]);
         return nullptr;
       }
-      lvar_expression->lvar = it->second;
       return lvar_expression;
     }
     break;
   }
+  case TokenKind::ExactlyOne:
+  case TokenKind::AtMost:
+  case TokenKind::AtLeast: return parse_cardinality(p);
   default:
     error("line %d: unexpected expression operand parsing of %s\n", p->line, TokenKind::to_string[peek(p)->kind]);
     return nullptr;
@@ -413,6 +730,15 @@ Expression *parse_operator(Parser *p, Expression *left_expression, i32 left_prec
       operator_expression_kind = ExpressionKind::Or;
       right_precedence         = 1;
       break;
+    // bind tighter than && and || like in C, so a && b == c is a && (b == c)
+    case TokenKind::Xor:
+      operator_expression_kind = ExpressionKind::Xor;
+      right_precedence         = 2;
+      break;
+    case TokenKind::Equal:
+      operator_expression_kind = ExpressionKind::Xnor;
+      right_precedence         = 2;
+      break;
     default: break;
     }
 
@@ -422,8 +748,10 @@ Expression *parse_operator(Parser *p, Expression *left_expression, i32 left_prec
 
     switch (peek(p)->kind) {
     case TokenKind::And:
-    case TokenKind::Or: {
-      Expression *binary_expression  = new Expression();
+    case TokenKind::Or:
+    case TokenKind::Xor:
+    case TokenKind::Equal: {
+      Expression *binary_expression  = p->expressions->make();
       binary_expression->kind        = operator_expression_kind;
       binary_expression->binary.left = left_expression;
       if (!binary_expression->binary.left) return nullptr;
@@ -445,10 +773,74 @@ Expression *parse_operator(Parser *p, Expression *left_expression, i32 left_prec
 
 Expression *parse_expression(Parser *p) { return parse_operator(p, parse_operand(p), 0); }
 
+// exactly_one(operands), at_most(bound, operands) or at_least(bound, operands), where operands are expressions or
+// grid slices separated by commas. A slice such as board[r][] counts every cell of the dimensions left empty.
+Expression *parse_cardinality(Parser *p) {
+  TokenKind::Enum keyword = peek(p)->kind;
+  if (!next(p)) return nullptr; // next 'cardinality keyword'
+
+  Expression *cardinality        = p->expressions->make();
+  cardinality->kind              = keyword == TokenKind::ExactlyOne ? ExpressionKind::Exactly
+                                   : keyword == TokenKind::AtMost   ? ExpressionKind::AtMost
+                                                                    : ExpressionKind::AtLeast;
+  cardinality->cardinality.bound = 1;
+
+  if (!check_peek(p, TokenKind::LParen)) {
+    error("line %d: expected ( after %s\n", p->line, TokenKind::to_string[keyword]);
+    return nullptr;
+  }
+  if (!next(p)) return nullptr; // next (
+
+  if (keyword != TokenKind::ExactlyOne) {
+    if (!check_peek(p, TokenKind::Intlit)) {
+      error("line %d: expected integer literal as the bound of %s\n", p->line, TokenKind::to_string[keyword]);
+      return nullptr;
+    }
+    cardinality->cardinality.bound = peek(p)->intlit;
+    if (!next(p)) return nullptr; // next 'intlit'
+
+    if (!check_peek(p, TokenKind::Comma)) {
+      error("line %d: expected , after the bound of %s\n", p->line, TokenKind::to_string[keyword]);
+      return nullptr;
+    }
+    if (!next(p)) return nullptr; // next ,
+  }
+
+  Expression **tail = &cardinality->cardinality.operands;
+  for (;;) {
+    p->allow_slices     = true;
+    Expression *operand = parse_operand(p);
+    if (!operand) return nullptr;
+
+    if (operand->kind == ExpressionKind::List) {
+      *tail = operand;
+    } else {
+      operand = parse_operator(p, operand, 0);
+      if (!operand) return nullptr;
+      Expression *element   = p->expressions->make();
+      element->kind         = ExpressionKind::List;
+      element->binary.left  = operand;
+      element->binary.right = nullptr;
+      *tail                 = element;
+    }
+    while (*tail) tail = &(*tail)->binary.right;
+
+    if (check_peek(p, TokenKind::RParen)) break;
+    if (!check_peek(p, TokenKind::Comma)) {
+      error("line %d: expected , or ) after operand of %s\n", p->line, TokenKind::to_string[keyword]);
+      return nullptr;
+    }
+    if (!next(p)) return nullptr; // next ,
+  }
+  if (!next(p)) return nullptr; // next )
+
+  return cardinality;
+}
+
 BasicBlock *parse_block(Parser *p, BasicBlock *entry_bb);
 
 BasicBlock *new_block(Parser *p) {
-  BasicBlock *bb      = new BasicBlock();
+  BasicBlock *bb      = p->blocks->make();
   bb->id              = p->block_count++;
   bb->terminator_kind = TerminatorKind::None;
   return bb;
@@ -500,16 +892,11 @@ Result parse_for(Parser *p, Instruction *instruction) {
     error("line %d: expected name for iterator variable\n", p->line);
     return err;
   }
-  Span iterator_name               = peek(p)->value;
-  std::string iterator_name_string = span_to_string(p, iterator_name);
+  i32 iterator_symbol = intern(p, peek(p)->value);
   if (!next(p)) return err; // next 'ident'
-  auto it = p->index_variable_map.find(iterator_name_string);
-  if (it == p->index_variable_map.end()) {
-    instruction->loop.indexvar = p->index_variable_count;
-    p->index_variable_map.insert(std::make_pair(iterator_name_string, p->index_variable_count++));
-  } else {
-    instruction->loop.indexvar = it->second;
-  }
+  i32 *indexvar = &p->symbols[(u32)iterator_symbol].index_variable;
+  if (*indexvar < 0) *indexvar = p->index_variable_count++;
+  instruction->loop.indexvar = *indexvar;
 
   if (!check_peek(p, TokenKind::In)) {
     error("line %d: expected 'in' keyword after for loop index variable\n", p->line);
@@ -550,17 +937,12 @@ BasicBlock *parse_block(Parser *p, BasicBlock *entry_bb) {
       Instruction assignment_inst;
       assignment_inst.kind = InstructionKind::Assign;
 
-      Span local_variable_name = peek(p)->value;
+      i32 local_variable_symbol = intern(p, peek(p)->value);
       if (!next(p)) return nullptr; // next 'ident'
 
-      std::string local_variable_name_string = span_to_string(p, local_variable_name);
-      auto it                                = p->local_variable_map.find(local_variable_name_string);
-      if (it == p->local_variable_map.end()) {
-        assignment_inst.assign.localvar = p->local_variable_count;
-        p->local_variable_map.insert(std::make_pair(local_variable_name_string, p->local_variable_count++));
-      } else {
-        assignment_inst.assign.localvar = it->second;
-      }
+      i32 *localvar = &p->symbols[(u32)local_variable_symbol].local_variable;
+      if (*localvar < 0) *localvar = p->local_variable_count++;
+      assignment_inst.assign.localvar = *localvar;
 
       if (!check_peek(p, TokenKind::Assign)) {
         cstr unexpected_kind = TokenKind::to_string[peek(p)->kind];
@@ -654,19 +1036,18 @@ BasicBlock *parse_file(Parser *p) {
         error("line %d: expected name for property\n", p->line);
         return nullptr;
       }
-      std::string name_string = span_to_string(p, peek(p)->value);
+      Span name  = peek(p)->value;
+      i32 symbol = intern(p, name);
       if (!next(p)) return nullptr; // next 'ident'
 
-      if (p->property_map.find(name_string) != p->property_map.end()) {
-        error("line %d: duplicate property name found for %s\n", p->line, name_string.c_str());
+      if (p->symbols[(u32)symbol].property >= 0) {
+        error("line %d: duplicate property name found for %.*s\n", p->line, name.length, &p->data[name.index]);
         return nullptr;
       }
+      i32 property                     = p->property_count++;
+      p->symbols[(u32)symbol].property = property;
 
-      Property new_property;
-      p->property_map.insert(std::make_pair(name_string, p->properties.size()));
-      p->properties.push_back(new_property);
-
-      Property *new_property_ptr = &p->properties.back();
+      i32 value_count = 0;
       if (!check_peek(p, TokenKind::LCurl)) {
         error("line %d: expected { after property name\n", p->line);
         return nullptr;
@@ -680,7 +1061,9 @@ BasicBlock *parse_file(Parser *p) {
           return nullptr;
         }
 
-        new_property_ptr->values.push_back(peek(p)->value);
+        // a repeated value name keeps referring to its first position
+        i32 value = intern(p, peek(p)->value);
+        p->property_values.emplace((u64)property << 32 | (u32)value, value_count++);
 
         if (!next(p)) return nullptr; // next 'ident'
       }
@@ -696,16 +1079,19 @@ BasicBlock *parse_file(Parser *p) {
         error("line %d: expected name for grid\n", p->line);
         return nullptr;
       }
-      std::string grid_name_string = span_to_string(p, peek(p)->value);
+      Span grid_name = peek(p)->value;
+      i32 symbol     = intern(p, grid_name);
       if (!next(p)) return nullptr; // next 'ident'
 
-      if (p->grids.find(grid_name_string) != p->grids.end()) {
-        error("line %d: found duplicate grid definition for %s\n", p->line, grid_name_string.c_str());
+      if (p->symbols[(u32)symbol].grid >= 0) {
+        error("line %d: found duplicate grid definition for %.*s\n", p->line, grid_name.length,
+              &p->data[grid_name.index]);
         return nullptr;
       }
 
-      p->grids.insert(std::make_pair(grid_name_string, Grid{}));
-      Grid *new_grid_ptr                 = &p->grids[grid_name_string];
+      p->symbols[(u32)symbol].grid = (i32)p->grids.size();
+      p->grids.push_back(Grid{});
+      Grid *new_grid_ptr                 = &p->grids.back();
       new_grid_ptr->variable_start_index = p->variable_count;
 
       i32 grid_size = 1;
@@ -737,7 +1123,7 @@ BasicBlock *parse_file(Parser *p) {
         return nullptr;
       }
       p->variable_count += grid_size;
-      debug("created grid %s with %d variables\n", grid_name_string.c_str(), grid_size);
+      debug("created grid %.*s with %d variables\n", grid_name.length, &p->data[grid_name.index], grid_size);
 
       break;
     }
@@ -750,47 +1136,122 @@ BasicBlock *parse_file(Parser *p) {
   return entry_bb;
 }
 
-Result parse_to_cfg(CFG *out_cfg, cstr filepath) {
-  Parser lex;
-  lex.variable_count       = 0;
-  lex.local_variable_count = 0;
-  lex.index_variable_count = 0;
-  lex.block_count          = 0;
-  lex.index                = 0;
-  lex.tlength              = 0;
-  lex.line                 = 1;
-  lex.data                 = nullptr;
-  lex.file_length          = 0;
+// Reads a stream that cannot be mapped, such as a pipe or stdin, into a heap buffer that grows as needed
+Result read_stream(FILE *fstream, CFG *out_cfg) {
+  i32 capacity = 0x100;
+  i32 length   = 0;
+  char *data   = new char[u32(capacity)];
+  for (;;) {
+    i32 remaining_capacity = capacity - length;
+    length += (i32)fread(data + length, 1, u32(remaining_capacity), fstream);
 
-  auto *fstream = fopen(filepath, "rb");
-  if (!fstream) {
-    error("could not open file %s\n", filepath);
+    if (length != capacity) break;
+
+    i64 new_capacity = ((i64)capacity << 1) - (capacity >> 1) + 8;
+    if (new_capacity > INT32_MAX) {
+      error("source file is larger than 2GB\n");
+      delete[] data;
+      return err;
+    }
+    capacity         = (i32)new_capacity;
+    char *new_buffer = new char[u32(capacity)];
+    memcpy(new_buffer, data, u32(length));
+    delete[] data;
+    data = new_buffer;
+  }
+  if (ferror(fstream)) {
+    error("could not read source file\n");
+    delete[] data;
     return err;
   }
 
-  i32 capacity = 0x100;
-  lex.data     = new char[u32(capacity)];
-  for (;;) {
-    i32 remaining_capacity = capacity - lex.file_length;
-    lex.file_length += fread(lex.data + lex.file_length, 1, u32(remaining_capacity), fstream);
+  out_cfg->file_data   = data;
+  out_cfg->file_length = length;
+  out_cfg->file_mapped = false;
+  return ok;
+}
 
-    if (lex.file_length != capacity) {
-      fclose(fstream);
-      break;
-    }
+void release_source(CFG *cfg) {
+  if (cfg->file_mapped) {
+    munmap((void *)cfg->file_data, (usize)cfg->file_length);
+  } else {
+    delete[] cfg->file_data;
+  }
+  cfg->file_data   = nullptr;
+  cfg->file_length = 0;
+  cfg->file_mapped = false;
+}
 
-    capacity         = (capacity << 1) - (capacity >> 1) + 8;
-    char *new_buffer = new char[u32(capacity)];
-    memcpy(new_buffer, lex.data, u32(lex.file_length));
-    delete[] lex.data;
-    lex.data = new_buffer;
+// Regular files are mapped read-only and the lexer runs directly over the mapping, so even very large generated
+// programs are never copied. "-" reads stdin, which like any other file that cannot be mapped is read into memory
+Result load_source(CFG *out_cfg, cstr filepath) {
+  release_source(out_cfg);
+  if (!strcmp(filepath, "-")) return read_stream(stdin, out_cfg);
+
+  int fd = open(filepath, O_RDONLY);
+  if (fd < 0) {
+    error("could not open file %s\n", filepath);
+    return err;
   }
 
-  debug("Parsing %d bytes from file %s\n", lex.file_length, filepath);
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) == 0 && S_ISREG(file_stat.st_mode) && file_stat.st_size > 0) {
+    if (file_stat.st_size > INT32_MAX) {
+      error("source file %s is larger than 2GB\n", filepath);
+      close(fd);
+      return err;
+    }
+    void *mapping = mmap(nullptr, (usize)file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping != MAP_FAILED) {
+      close(fd);
+      madvise(mapping, (usize)file_stat.st_size, MADV_SEQUENTIAL);
+      out_cfg->file_data   = (const char *)mapping;
+      out_cfg->file_length = (i32)file_stat.st_size;
+      out_cfg->file_mapped = true;
+      return ok;
+    }
+  }
+
+  FILE *fstream = fdopen(fd, "rb");
+  if (!fstream) {
+    error("could not open file %s\n", filepath);
+    close(fd);
+    return err;
+  }
+  Result result = read_stream(fstream, out_cfg);
+  fclose(fstream);
+  return result;
+}
 
-  out_cfg->entry_bb  = parse_file(&lex);
-  out_cfg->file_data = lex.data;
-  if (!out_cfg->entry_bb) {
+Result parse_source(CFG *cfg, Stats *stats) {
+  Parser lex;
+  lex.property_count       = 0;
+  lex.variable_count       = 0;
+  lex.local_variable_count = 0;
+  lex.index_variable_count = 0;
+  lex.block_count          = 0;
+  lex.token_count          = 0;
+  lex.index                = 0;
+  lex.tlength              = 0;
+  lex.line                 = 1;
+  lex.allow_slices         = false;
+
+  cfg->expressions.clear();
+  cfg->blocks.clear();
+  lex.expressions = &cfg->expressions;
+  lex.blocks      = &cfg->blocks;
+  lex.data        = cfg->file_data;
+  lex.file_length = cfg->file_length;
+
+  u64 start                 = now_ns();
+  cfg->entry_bb             = parse_file(&lex);
+  if (stats) end_phase(stats, Phase::Parse, start);
+  cfg->variable_count       = lex.variable_count;
+  cfg->local_variable_count = lex.local_variable_count;
+  cfg->index_variable_count = lex.index_variable_count;
+  cfg->block_count          = lex.block_count;
+  cfg->token_count          = lex.token_count;
+  if (!cfg->entry_bb) {
     error("failed to generate CFG\n");
     return err;
   }
@@ -798,4 +1259,13 @@ Result parse_to_cfg(CFG *out_cfg, cstr filepath) {
   return ok;
 }
 
+Result parse_to_cfg(CFG *out_cfg, cstr filepath, Stats *stats) {
+  u64 start = now_ns();
+  if (load_source(out_cfg, filepath)) return err;
+  if (stats) end_phase(stats, Phase::Read, start);
+
+  debug("Parsing %d bytes from file %s\n", out_cfg->file_length, filepath);
+  return parse_source(out_cfg, stats);
+}
+
 } // namespace slang
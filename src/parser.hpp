@@ -3,10 +3,42 @@
 
 #include "cfg.hpp"
 #include "general.hpp"
+#include "stats.hpp"
+#include <vector>
 
 namespace slang {
 
-Result parse_to_cfg(CFG *out_cfg, cstr filepath);
+// Reads and parses filepath into out_cfg, the time spent on each is added to stats when it is not null
+Result parse_to_cfg(CFG *out_cfg, cstr filepath, Stats *stats = nullptr);
+
+// The two halves of parse_to_cfg. load_source maps filepath, or reads it if it cannot be mapped, and "-" reads stdin.
+// parse_source then parses the source that was loaded into cfg.
+Result load_source(CFG *out_cfg, cstr filepath);
+Result parse_source(CFG *cfg, Stats *stats = nullptr);
+
+// clang-format off
+#define LEXER_MODE(pick) \
+  pick(Scalar, "scalar"), \
+  pick(Sse2,   "sse2"), \
+  pick(Avx2,   "avx2"),
+DECLARE_KIND(LEXER_MODE, LexerMode);
+// clang-format on
+
+// The widest byte classification the CPU supports, which the lexer uses unless set_lexer_mode picks another one
+LexerMode::Enum detect_lexer_mode();
+void set_lexer_mode(LexerMode::Enum mode);
+
+// A token as produced by the lexer, intlit is only set for integer literals
+struct LexedToken {
+  i32 kind;
+  i32 line;
+  Span value;
+  i32 intlit;
+};
+
+// Runs only the lexer over data and appends every token up to and including the end of file token to out_tokens,
+// which may be null to only lex
+Result lex(const char *data, i32 length, std::vector<LexedToken> *out_tokens);
 
 } // namespace slang
 
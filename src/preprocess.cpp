@@ -0,0 +1,425 @@
+#include "preprocess.hpp"
+
+#include <algorithm>
+
+namespace slang {
+
+// Variable elimination is only tried for variables with at most this many occurrences, and gives up when a
+// resolvent would be longer than the resolvent limit or there would be more resolvents than clauses it removes
+const usize elimination_occurrence_limit = 24;
+const usize resolvent_size_limit         = 24;
+const i32 elimination_rounds             = 3;
+
+// Probing stops once it has looked at this many literals of clauses in total
+const u64 probe_tick_limit = 20000000;
+
+struct PreprocessClause {
+  std::vector<int> literals;
+  u64 signature; // bit (variable % 64) is set for every variable of the clause
+  bool removed;
+};
+
+struct Preprocessor {
+  i32 frozen_variable_count;
+
+  std::vector<PreprocessClause> clauses;
+  // by variable, every clause that contained the variable when it was added. Entries are not removed when a clause
+  // is removed or loses the variable, users skip them instead
+  std::vector<std::vector<u32>> occurs;
+
+  std::vector<i8> values; // by variable, 1 true, -1 false, 0 unassigned
+  std::vector<bool> eliminated;
+  std::vector<int> trail;
+  usize propagation_head;
+
+  std::vector<u32> subsumption_queue;
+  std::vector<bool> queued;  // by clause
+  std::vector<bool> marks;   // by literal index, scratch for subsumption and resolution
+  std::vector<int> scratch;  // literals of the clause being added
+
+  ClauseDatabase *reconstruction;
+  PreprocessStats stats;
+};
+
+u32 var_index(int literal) { return (u32)(literal < 0 ? -literal : literal); }
+
+u32 literal_index(int literal) { return var_index(literal) << 1 | (literal < 0); }
+
+i8 literal_value(const Preprocessor *p, int literal) {
+  i8 value = p->values[var_index(literal)];
+  return literal < 0 ? (i8)-value : value;
+}
+
+u64 signature_of(const std::vector<int> &literals) {
+  u64 signature = 0;
+  for (int literal : literals) signature |= (u64)1 << (var_index(literal) % 64);
+  return signature;
+}
+
+bool contains(const PreprocessClause &clause, int literal) {
+  return std::find(clause.literals.begin(), clause.literals.end(), literal) != clause.literals.end();
+}
+
+void push_reconstruction(Preprocessor *p, int witness, const int *literals, usize count) {
+  p->reconstruction->push_literal(witness);
+  for (usize i = 0; i < count; ++i) {
+    if (literals[i] != witness) p->reconstruction->push_literal(literals[i]);
+  }
+  p->reconstruction->end_clause();
+}
+
+void assign(Preprocessor *p, int literal) {
+  i8 value = literal_value(p, literal);
+  if (value > 0) return;
+  if (value < 0) {
+    p->stats.unsatisfiable = true;
+    return;
+  }
+  p->values[var_index(literal)] = literal < 0 ? -1 : 1;
+  p->trail.push_back(literal);
+  ++p->stats.fixed_variables;
+  // variables that are not frozen disappear from the output, the unit gives them their value again
+  push_reconstruction(p, literal, &literal, 1);
+}
+
+void queue_for_subsumption(Preprocessor *p, u32 clause) {
+  if (p->queued[clause]) return;
+  p->queued[clause] = true;
+  p->subsumption_queue.push_back(clause);
+}
+
+// Adds the clause in p->scratch under the current assignment: false literals are dropped, satisfied clauses and
+// tautologies are not added at all and units are assigned
+void add_clause(Preprocessor *p) {
+  std::vector<int> &literals = p->scratch;
+  std::sort(literals.begin(), literals.end(), [](int a, int b) { return literal_index(a) < literal_index(b); });
+  literals.erase(std::unique(literals.begin(), literals.end()), literals.end());
+  usize kept = 0;
+  for (usize i = 0; i < literals.size(); ++i) {
+    if (i > 0 && literals[i] == -literals[i - 1]) return;
+    i8 value = literal_value(p, literals[i]);
+    if (value > 0) return;
+    if (value == 0) literals[kept++] = literals[i];
+  }
+  literals.resize(kept);
+
+  if (literals.empty()) {
+    p->stats.unsatisfiable = true;
+    return;
+  }
+  if (literals.size() == 1) {
+    assign(p, literals[0]);
+    return;
+  }
+  u32 clause = (u32)p->clauses.size();
+  p->clauses.push_back({literals, signature_of(literals), false});
+  p->queued.push_back(false);
+  for (int literal : literals) p->occurs[var_index(literal)].push_back(clause);
+  queue_for_subsumption(p, clause);
+}
+
+// Removes literal from the clause, a clause that becomes a unit is replaced by its assignment
+void strengthen(Preprocessor *p, u32 clause, int literal) {
+  PreprocessClause &c = p->clauses[clause];
+  c.literals.erase(std::find(c.literals.begin(), c.literals.end(), literal));
+  c.signature = signature_of(c.literals);
+  if (c.literals.size() == 1) {
+    assign(p, c.literals[0]);
+    c.removed = true;
+    return;
+  }
+  queue_for_subsumption(p, clause);
+}
+
+// Applies every assignment on the trail to the clauses. Returns false when the formula became unsatisfiable
+bool propagate(Preprocessor *p) {
+  while (p->propagation_head < p->trail.size() && !p->stats.unsatisfiable) {
+    int literal = p->trail[p->propagation_head++];
+    for (u32 clause : p->occurs[var_index(literal)]) {
+      PreprocessClause &c = p->clauses[clause];
+      if (c.removed) continue;
+      if (contains(c, literal)) {
+        c.removed = true;
+      } else if (contains(c, -literal)) {
+        strengthen(p, clause, -literal);
+      }
+    }
+    // clauses added from now on drop the variable, so nothing will be listed here again
+    p->occurs[var_index(literal)] = {};
+  }
+  return !p->stats.unsatisfiable;
+}
+
+// Removes the clauses the given clause subsumes, and removes the negated literal from the clauses it subsumes but for
+// one negated literal. Candidates come from the occurrence list of the clause's least frequent variable.
+void subsume_with(Preprocessor *p, u32 clause) {
+  const PreprocessClause &c = p->clauses[clause];
+  u32 best                  = var_index(c.literals[0]);
+  for (int literal : c.literals) {
+    if (p->occurs[var_index(literal)].size() < p->occurs[best].size()) best = var_index(literal);
+  }
+
+  for (int literal : c.literals) p->marks[literal_index(literal)] = true;
+  for (u32 other : p->occurs[best]) {
+    PreprocessClause &d = p->clauses[other];
+    if (other == clause || d.removed || d.literals.size() < c.literals.size()) continue;
+    if (c.signature & ~d.signature) continue;
+
+    usize matches = 0;
+    usize flips   = 0;
+    int flipped   = 0;
+    for (int literal : d.literals) {
+      if (p->marks[literal_index(literal)]) {
+        ++matches;
+      } else if (p->marks[literal_index(-literal)]) {
+        ++flips;
+        flipped = literal;
+      }
+    }
+    if (matches + flips != c.literals.size() || flips > 1) continue;
+    if (flips == 0) {
+      d.removed = true;
+      ++p->stats.subsumed_clauses;
+    } else {
+      strengthen(p, other, flipped);
+      ++p->stats.strengthened_clauses;
+    }
+  }
+  for (int literal : c.literals) p->marks[literal_index(literal)] = false;
+}
+
+// Runs subsumption for every queued clause, shortest first, until no clause changes anymore
+bool subsume(Preprocessor *p) {
+  std::sort(p->subsumption_queue.begin(), p->subsumption_queue.end(), [p](u32 a, u32 b) {
+    return p->clauses[a].literals.size() > p->clauses[b].literals.size();
+  });
+  while (p->subsumption_queue.size()) {
+    u32 clause = p->subsumption_queue.back();
+    p->subsumption_queue.pop_back();
+    p->queued[clause] = false;
+    if (p->clauses[clause].removed) continue;
+    subsume_with(p, clause);
+    if (!propagate(p)) return false;
+  }
+  return true;
+}
+
+// Assigns literal for the moment and propagates it over the clauses. Returns true when that falsifies a clause, the
+// assignments are undone either way
+bool probe_fails(Preprocessor *p, int literal, std::vector<int> *assigned, u64 *ticks) {
+  assigned->clear();
+  p->values[var_index(literal)] = literal < 0 ? -1 : 1;
+  assigned->push_back(literal);
+
+  bool conflict = false;
+  for (usize head = 0; head < assigned->size() && !conflict; ++head) {
+    int true_literal = (*assigned)[head];
+    for (u32 clause : p->occurs[var_index(true_literal)]) {
+      const PreprocessClause &c = p->clauses[clause];
+      if (c.removed) continue;
+      *ticks += c.literals.size();
+
+      usize unassigned = 0;
+      int last         = 0;
+      bool satisfied   = false;
+      for (int other : c.literals) {
+        i8 value = literal_value(p, other);
+        if (value > 0) {
+          satisfied = true;
+          break;
+        }
+        if (value == 0) {
+          ++unassigned;
+          last = other;
+        }
+      }
+      if (satisfied || unassigned > 1) continue;
+      if (unassigned == 0) {
+        conflict = true;
+        break;
+      }
+      p->values[var_index(last)] = last < 0 ? -1 : 1;
+      assigned->push_back(last);
+    }
+  }
+
+  for (int undo : *assigned) p->values[var_index(undo)] = 0;
+  return conflict;
+}
+
+// A literal whose assignment propagates to a conflict is false. Only variables that occur in a binary clause are
+// probed, the others cannot start a chain of implications.
+bool probe_failed_literals(Preprocessor *p) {
+  std::vector<bool> in_binary(p->values.size(), false);
+  for (const PreprocessClause &c : p->clauses) {
+    if (c.removed || c.literals.size() != 2) continue;
+    in_binary[var_index(c.literals[0])] = true;
+    in_binary[var_index(c.literals[1])] = true;
+  }
+
+  std::vector<int> assigned;
+  u64 ticks = 0;
+  for (u32 variable = 1; variable < p->values.size() && ticks < probe_tick_limit; ++variable) {
+    if (!in_binary[variable]) continue;
+    for (int literal : {(int)variable, -(int)variable}) {
+      if (p->values[variable] != 0 || !probe_fails(p, literal, &assigned, &ticks)) continue;
+      ++p->stats.failed_literals;
+      assign(p, -literal);
+      if (!propagate(p)) return false;
+    }
+  }
+  return true;
+}
+
+// Resolves the two clauses on variable into p->scratch. Returns false for a tautology
+bool resolve(Preprocessor *p, const PreprocessClause &positive, const PreprocessClause &negative, u32 variable) {
+  p->scratch.clear();
+  for (int literal : positive.literals) {
+    if (var_index(literal) == variable) continue;
+    p->marks[literal_index(literal)] = true;
+    p->scratch.push_back(literal);
+  }
+  bool tautology = false;
+  for (int literal : negative.literals) {
+    if (var_index(literal) == variable) continue;
+    if (p->marks[literal_index(-literal)]) {
+      tautology = true;
+      break;
+    }
+    if (!p->marks[literal_index(literal)]) p->scratch.push_back(literal);
+  }
+  for (int literal : positive.literals) p->marks[literal_index(literal)] = false;
+  return !tautology;
+}
+
+// Replaces the clauses of variable by all their non-tautological resolvents on it, if there are no more of them
+bool try_eliminate(Preprocessor *p, u32 variable, std::vector<std::vector<int>> *resolvents) {
+  std::vector<u32> &occurs = p->occurs[variable];
+  std::vector<u32> positive;
+  std::vector<u32> negative;
+  usize live = 0;
+  for (u32 clause : occurs) {
+    const PreprocessClause &c = p->clauses[clause];
+    if (c.removed) continue;
+    if (contains(c, (int)variable)) {
+      positive.push_back(clause);
+    } else if (contains(c, -(int)variable)) {
+      negative.push_back(clause);
+    } else {
+      continue;
+    }
+    occurs[live++] = clause;
+  }
+  occurs.resize(live);
+  if (live == 0 || live > elimination_occurrence_limit) return false;
+
+  resolvents->clear();
+  for (u32 pos : positive) {
+    for (u32 neg : negative) {
+      if (!resolve(p, p->clauses[pos], p->clauses[neg], variable)) continue;
+      if (p->scratch.size() > resolvent_size_limit || resolvents->size() == live) return false;
+      resolvents->push_back(p->scratch);
+    }
+  }
+
+  for (u32 clause : positive) {
+    PreprocessClause &c = p->clauses[clause];
+    push_reconstruction(p, (int)variable, c.literals.data(), c.literals.size());
+    c.removed = true;
+  }
+  for (u32 clause : negative) {
+    PreprocessClause &c = p->clauses[clause];
+    push_reconstruction(p, -(int)variable, c.literals.data(), c.literals.size());
+    c.removed = true;
+  }
+  occurs                  = {};
+  p->eliminated[variable] = true;
+  ++p->stats.eliminated_variables;
+
+  for (std::vector<int> &resolvent : *resolvents) {
+    p->scratch.swap(resolvent);
+    add_clause(p);
+  }
+  return propagate(p) && subsume(p);
+}
+
+// Tries to eliminate every variable that is not frozen, least occurring first, and repeats while that helps
+bool eliminate_variables(Preprocessor *p) {
+  std::vector<std::vector<int>> resolvents;
+  std::vector<u32> candidates;
+  for (i32 round = 0; round < elimination_rounds; ++round) {
+    candidates.clear();
+    for (u32 variable = (u32)p->frozen_variable_count + 1; variable < p->values.size(); ++variable) {
+      if (p->values[variable] == 0 && !p->eliminated[variable] && p->occurs[variable].size()) {
+        candidates.push_back(variable);
+      }
+    }
+    std::stable_sort(candidates.begin(), candidates.end(),
+                     [p](u32 a, u32 b) { return p->occurs[a].size() < p->occurs[b].size(); });
+
+    u64 eliminated_before = p->stats.eliminated_variables;
+    for (u32 variable : candidates) {
+      if (p->values[variable] != 0) continue;
+      try_eliminate(p, variable, &resolvents);
+      if (p->stats.unsatisfiable) return false;
+    }
+    if (p->stats.eliminated_variables == eliminated_before) break;
+  }
+  return true;
+}
+
+PreprocessStats preprocess(const ClauseDatabase &cnf, i32 frozen_variable_count, ClauseDatabase *out_cnf,
+                           ClauseDatabase *out_reconstruction) {
+  Preprocessor preprocessor;
+  Preprocessor *p            = &preprocessor;
+  p->frozen_variable_count   = frozen_variable_count;
+  p->occurs.resize((usize)cnf.max_variable + 1);
+  p->values.assign((usize)cnf.max_variable + 1, 0);
+  p->eliminated.assign((usize)cnf.max_variable + 1, false);
+  p->marks.assign(2 * ((usize)cnf.max_variable + 1), false);
+  p->propagation_head = 0;
+  p->reconstruction   = out_reconstruction;
+  p->clauses.reserve(cnf.clause_count());
+
+  for (usize i = 0; i < cnf.clause_count() && !p->stats.unsatisfiable; ++i) {
+    Clause clause = cnf.clause(i);
+    p->scratch.assign(clause.begin(), clause.end());
+    add_clause(p);
+  }
+  if (!p->stats.unsatisfiable && propagate(p) && subsume(p) && probe_failed_literals(p) && subsume(p)) {
+    eliminate_variables(p);
+  }
+
+  *out_cnf              = ClauseDatabase();
+  out_cnf->max_variable = cnf.max_variable;
+  if (p->stats.unsatisfiable) {
+    out_cnf->end_clause();
+    return p->stats;
+  }
+  for (int literal : p->trail) {
+    if ((i32)var_index(literal) <= frozen_variable_count) out_cnf->add_clause({literal});
+  }
+  for (const PreprocessClause &c : p->clauses) {
+    if (!c.removed) out_cnf->add_clause(c.literals.data(), c.literals.size());
+  }
+  return p->stats;
+}
+
+// Goes through the removed clauses from the last one removed to the first and makes the witness of every clause the
+// model falsifies true. Clauses removed later were removed from a formula in which the earlier ones were already gone,
+// so flipping a witness never falsifies a clause that was already handled.
+void extend_model(const ClauseDatabase &reconstruction, std::vector<bool> *model) {
+  for (usize i = reconstruction.clause_count(); i-- > 0;) {
+    Clause clause  = reconstruction.clause(i);
+    bool satisfied = false;
+    for (int literal : clause) {
+      if ((*model)[var_index(literal)] == (literal > 0)) {
+        satisfied = true;
+        break;
+      }
+    }
+    if (!satisfied) (*model)[var_index(clause.first[0])] = clause.first[0] > 0;
+  }
+}
+
+} // namespace slang
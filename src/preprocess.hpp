@@ -0,0 +1,33 @@
+#ifndef PREPROCESS_HPP
+#define PREPROCESS_HPP
+
+#include "clause_database.hpp"
+#include "general.hpp"
+#include <vector>
+
+namespace slang {
+
+struct PreprocessStats {
+  u64 fixed_variables      = 0;
+  u64 failed_literals      = 0;
+  u64 subsumed_clauses     = 0;
+  u64 strengthened_clauses = 0;
+  u64 eliminated_variables = 0;
+  bool unsatisfiable       = false;
+};
+
+// Simplifies cnf into out_cnf with unit propagation, failed literal probing, subsumption, self-subsuming resolution
+// and bounded variable elimination. Variables 1 to frozen_variable_count are never eliminated and the units found
+// for them are kept, so out_cnf has the same models as cnf on those variables. Variables keep their numbers and
+// out_cnf->max_variable is the one of cnf.
+//
+// Clauses that were removed in a way that loses models are pushed to out_reconstruction with the literal that
+// satisfies them first, extend_model uses them to turn a model of out_cnf into a model of cnf.
+PreprocessStats preprocess(const ClauseDatabase &cnf, i32 frozen_variable_count, ClauseDatabase *out_cnf,
+                           ClauseDatabase *out_reconstruction);
+
+void extend_model(const ClauseDatabase &reconstruction, std::vector<bool> *model);
+
+} // namespace slang
+
+#endif
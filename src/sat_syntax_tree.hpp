@@ -1,83 +1,114 @@
 #ifndef SAT_EXPRESSION_HPP
 #define SAT_EXPRESSION_HPP
 
+#include "arena.hpp"
 #include <cassert>
 #include <iostream>
 #include <memory>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
-enum Operator { Literal, AND, OR, NOT };
+// XOR is true when exactly one of its children is and XNOR when both or neither are. ATMOST is true when at most
+// literal of the operands in its rightChild are true. The operands are a chain of LIST nodes, each with one operand
+// as leftChild and the rest of the chain as rightChild, null after the last operand.
+enum Operator { Literal, AND, OR, NOT, ATMOST, LIST, XOR, XNOR };
 
 struct SAT_Expression {
   Operator op;
   int literal;
+  int id; // index in the owning SAT_ExpressionTable, -1 if the node was not built through a table
   SAT_Expression *leftChild;
-  SAT_Expression *rightChild; // ONLY rightChild exists if op is NOT!!!!
+  SAT_Expression *rightChild; // ONLY rightChild exists if op is NOT or ATMOST!!!!
 
   // Constructor for a literal node
   SAT_Expression(const int &literalProp)
-      : op(Operator::Literal), literal(literalProp), leftChild(nullptr), rightChild(nullptr) {}
+      : op(Operator::Literal), literal(literalProp), id(-1), leftChild(nullptr), rightChild(nullptr) {}
 
   // Constructor for a non-literal node
   SAT_Expression(Operator operatorType, SAT_Expression *left, SAT_Expression *right)
-      : op(operatorType), literal(-999999999), leftChild(left), rightChild(right) {
+      : op(operatorType), literal(-999999999), id(-1), leftChild(left), rightChild(right) {
     // assert if op is NOT that left child is null
     if (op == Operator::NOT) {
       assert(leftChild == nullptr);
     }
   }
 
-  // considers (a v b) v c differently from a v (b v c)
-  bool operator==(const SAT_Expression &other) const {
-    if (op != other.op || literal != other.literal) {
-      return false;
-    } else if (op == Operator::Literal) {
-      return literal == other.literal;
-    }
-
-    // Compare left and right children recursively
-    if (leftChild && other.leftChild) {
-      if (!(*leftChild == *other.leftChild)) {
-        return false;
-      }
-    } else if (leftChild || other.leftChild) {
-      return false; // One has a child, the other doesn't
-    }
+  // Constructor for an ATMOST node, the bound is kept in literal
+  SAT_Expression(int bound, SAT_Expression *operands)
+      : op(Operator::ATMOST), literal(bound), id(-1), leftChild(nullptr), rightChild(operands) {}
 
-    if (rightChild && other.rightChild) {
-      return *rightChild == *other.rightChild;
-    } else {
-      return !(rightChild || other.rightChild); // One has a child, the other doesn't
-    }
+  // Children are hash-consed by SAT_ExpressionTable so two nodes are structurally equal exactly when their
+  // operator, literal and child nodes are identical. Still considers (a v b) v c differently from a v (b v c)
+  bool operator==(const SAT_Expression &other) const {
+    return op == other.op && literal == other.literal && leftChild == other.leftChild &&
+           rightChild == other.rightChild;
   }
 
   bool isLiteral() const { return op == Operator::Literal; }
 
+  // Prints the formula as a tree, keeping pending nodes on an explicit stack so deep formulas can be printed too.
+  // A node with several parents is printed as [n](...) the first time and as [n] afterwards, which keeps the
+  // output linear in the size of the DAG when branches share their continuation. Shared nodes are numbered in the
+  // order they are printed so the output does not depend on the order the nodes were created in
   void display() const {
-    if (isLiteral()) {
-      std::cout << literal;
-    } else {
-      std::cout << "(";
-      if (leftChild) {
-        leftChild->display();
-        std::cout << " ";
-      } else {
-        std::cout << "";
+    std::unordered_map<const SAT_Expression *, int> parentCount;
+    std::vector<const SAT_Expression *> worklist{this};
+    while (!worklist.empty()) {
+      const SAT_Expression *expression = worklist.back();
+      worklist.pop_back();
+      for (const SAT_Expression *child : {expression->leftChild, expression->rightChild}) {
+        if (child && !child->isLiteral() && parentCount[child]++ == 0) worklist.push_back(child);
       }
+    }
 
-      switch (op) {
-      case Operator::AND: std::cout << "AND "; break;
-      case Operator::OR: std::cout << "OR "; break;
-      case Operator::NOT: std::cout << "NOT "; break;
-      default: std::cout << "Unknown ";
+    struct Pending {
+      const SAT_Expression *expression;
+      int stage;
+    };
+    std::unordered_map<const SAT_Expression *, int> printed;
+    std::vector<Pending> stack;
+    stack.push_back({this, 0});
+    while (!stack.empty()) {
+      const SAT_Expression *expression = stack.back().expression;
+      if (expression->isLiteral()) {
+        std::cout << expression->literal;
+        stack.pop_back();
+        continue;
       }
 
-      if (rightChild) {
-        rightChild->display();
-      } else {
-        std::cout << "";
+      switch (stack.back().stage++) {
+      case 0:
+        if (parentCount[expression] > 1) {
+          auto inserted = printed.emplace(expression, static_cast<int>(printed.size()));
+          std::cout << "[" << inserted.first->second << "]";
+          if (!inserted.second) {
+            stack.pop_back();
+            break;
+          }
+        }
+        std::cout << "(";
+        if (expression->leftChild) stack.push_back({expression->leftChild, 0});
+        break;
+      case 1:
+        if (expression->leftChild) std::cout << " ";
+        switch (expression->op) {
+        case Operator::AND: std::cout << "AND "; break;
+        case Operator::OR: std::cout << "OR "; break;
+        case Operator::NOT: std::cout << "NOT "; break;
+        case Operator::XOR: std::cout << "XOR "; break;
+        case Operator::XNOR: std::cout << "XNOR "; break;
+        case Operator::ATMOST: std::cout << "ATMOST " << expression->literal << " "; break;
+        case Operator::LIST: std::cout << (expression->rightChild ? ", " : ""); break;
+        default: std::cout << "Unknown ";
+        }
+        if (expression->rightChild) stack.push_back({expression->rightChild, 0});
+        break;
+      default:
+        std::cout << ")";
+        stack.pop_back();
+        break;
       }
-      std::cout << ")";
     }
   }
 };
@@ -89,14 +120,9 @@ struct hash<SAT_Expression> {
     std::size_t hash = std::hash<int>()(static_cast<int>(expression.op));
     hash_combine(hash, expression.literal);
 
-    // Hash left and right children recursively
-    if (expression.leftChild) {
-      hash_combine(hash, std::hash<SAT_Expression>()(*expression.leftChild));
-    }
-
-    if (expression.rightChild) {
-      hash_combine(hash, std::hash<SAT_Expression>()(*expression.rightChild));
-    }
+    // Children are already unique so only their ids take part in the hash
+    hash_combine(hash, expression.leftChild ? expression.leftChild->id : -1);
+    hash_combine(hash, expression.rightChild ? expression.rightChild->id : -1);
 
     return hash;
   }
@@ -110,4 +136,110 @@ struct hash<SAT_Expression> {
 };
 } // namespace std
 
+// Owns every SAT_Expression of a compilation and hash-conses them, so structurally identical subformulas are
+// built once and shared. Nodes live in chunked storage and never move, and ids are handed out in creation order
+// which means the children of a node always have a smaller id than the node itself.
+//
+// A table constructed with a base table is an overlay for one thread: it finds existing nodes in base, which must
+// not change while the overlay is in use, and only keeps the nodes base does not have. Its ids continue after the
+// ids base had when the overlay was cleared, so a node belongs to the overlay exactly when id >= firstId().
+class SAT_ExpressionTable {
+public:
+  SAT_ExpressionTable() : base(nullptr) { clear(); }
+  explicit SAT_ExpressionTable(const SAT_ExpressionTable *baseTable) : base(baseTable) { clear(); }
+
+  SAT_ExpressionTable(const SAT_ExpressionTable &) = delete;
+  SAT_ExpressionTable &operator=(const SAT_ExpressionTable &) = delete;
+
+  SAT_Expression *literal(int literalProp) { return intern(SAT_Expression(literalProp)); }
+
+  SAT_Expression *node(Operator operatorType, SAT_Expression *left, SAT_Expression *right) {
+    return intern(SAT_Expression(operatorType, left, right));
+  }
+
+  SAT_Expression *atMost(int bound, SAT_Expression *operands) { return intern(SAT_Expression(bound, operands)); }
+
+  // Node with the operator and literal of like but the given children, for copying nodes from another table
+  SAT_Expression *copy(const SAT_Expression *like, SAT_Expression *left, SAT_Expression *right) {
+    SAT_Expression key = *like;
+    key.leftChild      = left;
+    key.rightChild     = right;
+    return intern(key);
+  }
+
+  int size() const { return firstNodeId + static_cast<int>(nodes.size()); }
+
+  int firstId() const { return firstNodeId; }
+
+  // Lookups that found an existing node and lookups that made a new one, clear() keeps counting
+  u64 hits() const { return hitCount; }
+  u64 misses() const { return missCount; }
+
+  // Counts the lookups of an overlay as lookups of this table
+  void addLookups(const SAT_ExpressionTable &overlay) {
+    hitCount += overlay.hitCount;
+    missCount += overlay.missCount;
+  }
+
+  const SAT_Expression *at(int id) const { return &nodes[static_cast<std::size_t>(id - firstNodeId)]; }
+
+  // Drops every node but keeps their memory for the next compilation
+  void clear() {
+    index.clear();
+    nodes.clear();
+    if (base) {
+      firstNodeId     = base->size();
+      falseExpression = base->falseExpression;
+      trueExpression  = base->trueExpression;
+      return;
+    }
+    firstNodeId                   = 0;
+    SAT_Expression *literal_1     = literal(1);
+    SAT_Expression *not_literal_1 = node(Operator::NOT, nullptr, literal_1);
+    falseExpression               = node(Operator::AND, literal_1, not_literal_1);
+    trueExpression                = node(Operator::OR, literal_1, not_literal_1);
+  }
+
+  // (1 AND NOT 1) and (1 OR NOT 1), compared by address when simplifying
+  SAT_Expression *falseExpression;
+  SAT_Expression *trueExpression;
+
+private:
+  struct NodeHash {
+    std::size_t operator()(const SAT_Expression *expression) const { return std::hash<SAT_Expression>()(*expression); }
+  };
+
+  struct NodeEqual {
+    bool operator()(const SAT_Expression *a, const SAT_Expression *b) const { return *a == *b; }
+  };
+
+  SAT_Expression *intern(SAT_Expression key) {
+    if (base) {
+      auto it = base->index.find(&key);
+      if (it != base->index.end()) {
+        ++hitCount;
+        return *it;
+      }
+    }
+    auto it = index.find(&key);
+    if (it != index.end()) {
+      ++hitCount;
+      return *it;
+    }
+
+    ++missCount;
+    key.id                     = size();
+    SAT_Expression *expression = nodes.make(key);
+    index.insert(expression);
+    return expression;
+  }
+
+  const SAT_ExpressionTable *base;
+  int firstNodeId;
+  u64 hitCount  = 0;
+  u64 missCount = 0;
+  slang::Pool<SAT_Expression> nodes;
+  std::unordered_set<SAT_Expression *, NodeHash, NodeEqual> index;
+};
+
 #endif // SAT_EXPRESSION_HPP
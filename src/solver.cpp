@@ -0,0 +1,480 @@
+#include "solver.hpp"
+
+#include <algorithm>
+
+namespace slang {
+
+// Literals are 2 * variable + 1 if negated, with variables counted from 0
+using Lit       = u32;
+using ClauseRef = u32;
+
+const Lit no_lit          = UINT32_MAX;
+const ClauseRef no_reason = UINT32_MAX;
+
+Lit lit_from_dimacs(int literal) {
+  return literal > 0 ? (u32)(literal - 1) << 1 : ((u32)(-(literal + 1)) << 1) | 1;
+}
+
+u32 var_of(Lit lit) { return lit >> 1; }
+
+bool is_negated(Lit lit) { return lit & 1; }
+
+Lit negate(Lit lit) { return lit ^ 1; }
+
+// Values are stored per variable, a literal is true when the value of its variable agrees with its sign
+const i8 value_true       = 1;
+const i8 value_false      = -1;
+const i8 value_unassigned = 0;
+
+// Every clause lives in Solver::memory as [size][lbd << 2 | deleted << 1 | learnt][literals...] and is referred to
+// by the offset of its header. The two watched literals are always the first two.
+const u32 clause_header_size = 2;
+const u32 learnt_flag        = 1;
+const u32 deleted_flag       = 2;
+
+// Learned clauses with at most this many distinct decision levels are never removed
+const u32 glue_lbd = 2;
+
+const f64 activity_decay = 0.95;
+const u64 restart_unit   = 100;
+
+struct Watcher {
+  ClauseRef cref;
+  Lit blocker; // another literal of the clause, while it is true the clause does not need to be visited
+};
+
+struct Solver {
+  u32 variable_count;
+
+  std::vector<u32> memory;
+  std::vector<ClauseRef> learnts;
+  std::vector<std::vector<Watcher>> watches; // by literal, clauses to visit once that literal becomes false
+
+  std::vector<i8> values;
+  std::vector<u32> levels;
+  std::vector<ClauseRef> reasons;
+  std::vector<bool> saved_phases; // whether the variable was last assigned false
+  std::vector<Lit> trail;
+  std::vector<usize> trail_limits; // trail size at the start of every decision level
+  usize propagation_head;
+
+  std::vector<f64> activities;
+  f64 activity_increment;
+  std::vector<u32> heap; // binary max heap of variables ordered by activity
+  std::vector<i32> heap_positions;
+
+  std::vector<u8> seen;
+  std::vector<Lit> learnt_clause;
+  std::vector<Lit> analyze_stack;
+  std::vector<u64> level_stamps;
+  u64 stamp;
+
+  usize max_learnts;
+};
+
+i8 lit_value(Solver *s, Lit lit) {
+  i8 value = s->values[var_of(lit)];
+  return is_negated(lit) ? (i8)-value : value;
+}
+
+u32 decision_level(Solver *s) { return (u32)s->trail_limits.size(); }
+
+u32 clause_size(Solver *s, ClauseRef cref) { return s->memory[cref]; }
+
+u32 *clause_literals(Solver *s, ClauseRef cref) { return &s->memory[cref + clause_header_size]; }
+
+bool heap_less(Solver *s, u32 a, u32 b) { return s->activities[a] > s->activities[b]; }
+
+void heap_percolate_up(Solver *s, u32 position) {
+  u32 var = s->heap[position];
+  while (position > 0) {
+    u32 parent = (position - 1) >> 1;
+    if (!heap_less(s, var, s->heap[parent])) break;
+    s->heap[position]                    = s->heap[parent];
+    s->heap_positions[s->heap[position]] = (i32)position;
+    position                             = parent;
+  }
+  s->heap[position]      = var;
+  s->heap_positions[var] = (i32)position;
+}
+
+void heap_percolate_down(Solver *s, u32 position) {
+  u32 var  = s->heap[position];
+  u32 size = (u32)s->heap.size();
+  for (;;) {
+    u32 child = 2 * position + 1;
+    if (child >= size) break;
+    if (child + 1 < size && heap_less(s, s->heap[child + 1], s->heap[child])) ++child;
+    if (!heap_less(s, s->heap[child], var)) break;
+    s->heap[position]                    = s->heap[child];
+    s->heap_positions[s->heap[position]] = (i32)position;
+    position                             = child;
+  }
+  s->heap[position]      = var;
+  s->heap_positions[var] = (i32)position;
+}
+
+void heap_insert(Solver *s, u32 var) {
+  if (s->heap_positions[var] >= 0) return;
+  s->heap.push_back(var);
+  heap_percolate_up(s, (u32)s->heap.size() - 1);
+}
+
+u32 heap_pop(Solver *s) {
+  u32 top                = s->heap[0];
+  s->heap_positions[top] = -1;
+  u32 last               = s->heap.back();
+  s->heap.pop_back();
+  if (!s->heap.empty()) {
+    s->heap[0] = last;
+    heap_percolate_down(s, 0);
+  }
+  return top;
+}
+
+void bump_variable(Solver *s, u32 var) {
+  s->activities[var] += s->activity_increment;
+  if (s->activities[var] > 1e100) {
+    for (f64 &activity : s->activities) activity *= 1e-100;
+    s->activity_increment *= 1e-100;
+  }
+  if (s->heap_positions[var] >= 0) heap_percolate_up(s, (u32)s->heap_positions[var]);
+}
+
+void enqueue(Solver *s, Lit lit, ClauseRef reason) {
+  u32 var         = var_of(lit);
+  s->values[var]  = is_negated(lit) ? value_false : value_true;
+  s->levels[var]  = decision_level(s);
+  s->reasons[var] = reason;
+  s->trail.push_back(lit);
+}
+
+ClauseRef allocate_clause(Solver *s, const Lit *lits, u32 size, bool learnt, u32 lbd) {
+  ClauseRef cref = (ClauseRef)s->memory.size();
+  s->memory.push_back(size);
+  s->memory.push_back(lbd << 2 | (learnt ? learnt_flag : 0));
+  s->memory.insert(s->memory.end(), lits, lits + size);
+  return cref;
+}
+
+void attach_clause(Solver *s, ClauseRef cref) {
+  u32 *lits = clause_literals(s, cref);
+  s->watches[lits[0]].push_back({cref, lits[1]});
+  s->watches[lits[1]].push_back({cref, lits[0]});
+}
+
+// Returns the clause that became conflicting or no_reason once every enqueued literal has been propagated
+ClauseRef propagate(Solver *s) {
+  while (s->propagation_head < s->trail.size()) {
+    Lit false_lit                  = negate(s->trail[s->propagation_head++]);
+    std::vector<Watcher> &watchers = s->watches[false_lit];
+
+    usize i = 0;
+    usize j = 0;
+    while (i < watchers.size()) {
+      Watcher watcher = watchers[i++];
+      if (lit_value(s, watcher.blocker) == value_true) {
+        watchers[j++] = watcher;
+        continue;
+      }
+
+      u32 *lits = clause_literals(s, watcher.cref);
+      if (lits[0] == false_lit) std::swap(lits[0], lits[1]);
+      Lit first = lits[0];
+      if (first != watcher.blocker && lit_value(s, first) == value_true) {
+        watchers[j++] = {watcher.cref, first};
+        continue;
+      }
+
+      u32 size   = clause_size(s, watcher.cref);
+      bool moved = false;
+      for (u32 k = 2; k < size; ++k) {
+        if (lit_value(s, lits[k]) != value_false) {
+          lits[1] = lits[k];
+          lits[k] = false_lit;
+          s->watches[lits[1]].push_back({watcher.cref, first});
+          moved = true;
+          break;
+        }
+      }
+      if (moved) continue;
+
+      watchers[j++] = {watcher.cref, first};
+      if (lit_value(s, first) == value_false) {
+        while (i < watchers.size()) watchers[j++] = watchers[i++];
+        watchers.resize(j);
+        return watcher.cref;
+      }
+      enqueue(s, first, watcher.cref);
+    }
+    watchers.resize(j);
+  }
+  return no_reason;
+}
+
+// A literal of the learned clause is redundant if every other literal of its reason is already in the clause
+bool is_redundant(Solver *s, Lit lit) {
+  ClauseRef reason = s->reasons[var_of(lit)];
+  if (reason == no_reason) return false;
+  u32 *lits = clause_literals(s, reason);
+  u32 size  = clause_size(s, reason);
+  for (u32 k = 1; k < size; ++k) {
+    u32 var = var_of(lits[k]);
+    if (!s->seen[var] && s->levels[var] > 0) return false;
+  }
+  return true;
+}
+
+// First UIP conflict analysis. Leaves the learned clause in s->learnt_clause with the asserting literal first and a
+// literal of the backtrack level second
+void analyze(Solver *s, ClauseRef conflict, u32 *out_backtrack_level, u32 *out_lbd) {
+  s->learnt_clause.clear();
+  s->learnt_clause.push_back(no_lit);
+
+  i32 path_count = 0;
+  Lit lit        = no_lit;
+  usize index    = s->trail.size();
+  do {
+    u32 *lits = clause_literals(s, conflict);
+    u32 size  = clause_size(s, conflict);
+    for (u32 k = lit == no_lit ? 0 : 1; k < size; ++k) {
+      Lit q   = lits[k];
+      u32 var = var_of(q);
+      if (s->seen[var] || s->levels[var] == 0) continue;
+      s->seen[var] = 1;
+      bump_variable(s, var);
+      if (s->levels[var] >= decision_level(s)) {
+        ++path_count;
+      } else {
+        s->learnt_clause.push_back(q);
+      }
+    }
+
+    do {
+      --index;
+    } while (!s->seen[var_of(s->trail[index])]);
+    lit                  = s->trail[index];
+    conflict             = s->reasons[var_of(lit)];
+    s->seen[var_of(lit)] = 0;
+    --path_count;
+  } while (path_count > 0);
+  s->learnt_clause[0] = negate(lit);
+
+  s->analyze_stack.assign(s->learnt_clause.begin() + 1, s->learnt_clause.end());
+  usize kept = 1;
+  for (usize i = 1; i < s->learnt_clause.size(); ++i) {
+    if (!is_redundant(s, s->learnt_clause[i])) s->learnt_clause[kept++] = s->learnt_clause[i];
+  }
+  s->learnt_clause.resize(kept);
+  for (Lit q : s->analyze_stack) s->seen[var_of(q)] = 0;
+
+  u32 backtrack_level = 0;
+  if (s->learnt_clause.size() > 1) {
+    usize max_index = 1;
+    for (usize i = 2; i < s->learnt_clause.size(); ++i) {
+      if (s->levels[var_of(s->learnt_clause[i])] > s->levels[var_of(s->learnt_clause[max_index])]) max_index = i;
+    }
+    std::swap(s->learnt_clause[1], s->learnt_clause[max_index]);
+    backtrack_level = s->levels[var_of(s->learnt_clause[1])];
+  }
+
+  ++s->stamp;
+  u32 lbd = 0;
+  for (Lit q : s->learnt_clause) {
+    u32 level = s->levels[var_of(q)];
+    if (s->level_stamps[level] != s->stamp) {
+      s->level_stamps[level] = s->stamp;
+      ++lbd;
+    }
+  }
+
+  *out_backtrack_level = backtrack_level;
+  *out_lbd             = lbd;
+}
+
+void backtrack(Solver *s, u32 level) {
+  if (decision_level(s) <= level) return;
+  usize limit = s->trail_limits[level];
+  for (usize i = s->trail.size(); i-- > limit;) {
+    u32 var              = var_of(s->trail[i]);
+    s->saved_phases[var] = is_negated(s->trail[i]);
+    s->values[var]       = value_unassigned;
+    heap_insert(s, var);
+  }
+  s->trail.resize(limit);
+  s->trail_limits.resize(level);
+  s->propagation_head = limit;
+}
+
+Lit pick_branch_literal(Solver *s) {
+  while (!s->heap.empty()) {
+    u32 var = heap_pop(s);
+    if (s->values[var] == value_unassigned) return var << 1 | (s->saved_phases[var] ? 1 : 0);
+  }
+  return no_lit;
+}
+
+// Only called at decision level 0: keeps the learned clauses with the lowest LBD, drops every clause that is already
+// satisfied by a top level assignment and compacts the clause memory
+void reduce_clauses(Solver *s) {
+  assert(decision_level(s) == 0);
+  std::stable_sort(s->learnts.begin(), s->learnts.end(), [s](ClauseRef a, ClauseRef b) {
+    return (s->memory[a + 1] >> 2) < (s->memory[b + 1] >> 2);
+  });
+  for (usize i = s->learnts.size() / 2; i < s->learnts.size(); ++i) {
+    ClauseRef cref = s->learnts[i];
+    if ((s->memory[cref + 1] >> 2) > glue_lbd) s->memory[cref + 1] |= deleted_flag;
+  }
+
+  // Top level assignments never need their reason again
+  for (Lit lit : s->trail) s->reasons[var_of(lit)] = no_reason;
+
+  std::vector<u32> compacted;
+  compacted.reserve(s->memory.size());
+  s->learnts.clear();
+  for (ClauseRef cref = 0; cref < s->memory.size(); cref += clause_header_size + s->memory[cref]) {
+    u32 size  = s->memory[cref];
+    u32 flags = s->memory[cref + 1];
+    if (flags & deleted_flag) continue;
+
+    u32 *lits      = clause_literals(s, cref);
+    bool satisfied = false;
+    for (u32 k = 0; k < size; ++k) {
+      if (lit_value(s, lits[k]) == value_true) {
+        satisfied = true;
+        break;
+      }
+    }
+    if (satisfied) continue;
+
+    if (flags & learnt_flag) s->learnts.push_back((ClauseRef)compacted.size());
+    compacted.insert(compacted.end(), &s->memory[cref], lits + size);
+  }
+  s->memory.swap(compacted);
+
+  for (auto &watchers : s->watches) watchers.clear();
+  for (ClauseRef cref = 0; cref < s->memory.size(); cref += clause_header_size + s->memory[cref]) {
+    attach_clause(s, cref);
+  }
+}
+
+// Finite subsequence of the Luby sequence 1 1 2 1 1 2 4 1 1 2 ... used to space out restarts
+u64 luby(u64 index) {
+  u64 size = 1;
+  u32 seq  = 0;
+  while (size < index + 1) {
+    ++seq;
+    size = 2 * size + 1;
+  }
+  while (size - 1 != index) {
+    size = (size - 1) >> 1;
+    --seq;
+    index = index % size;
+  }
+  return (u64)1 << seq;
+}
+
+// Adds an input clause at decision level 0. Returns err if the clause is empty or contradicts a top level unit
+Result add_input_clause(Solver *s, Clause clause, std::vector<Lit> &lits) {
+  lits.clear();
+  for (int literal : clause) lits.push_back(lit_from_dimacs(literal));
+  std::sort(lits.begin(), lits.end());
+  lits.erase(std::unique(lits.begin(), lits.end()), lits.end());
+  for (usize i = 1; i < lits.size(); ++i) {
+    if (lits[i] == negate(lits[i - 1])) return ok; // tautology
+  }
+
+  if (lits.empty()) return err;
+  if (lits.size() == 1) {
+    i8 value = lit_value(s, lits[0]);
+    if (value == value_false) return err;
+    if (value == value_unassigned) enqueue(s, lits[0], no_reason);
+    return ok;
+  }
+  attach_clause(s, allocate_clause(s, lits.data(), (u32)lits.size(), false, 0));
+  return ok;
+}
+
+void init_solver(Solver *s, u32 variable_count) {
+  s->variable_count = variable_count;
+  s->watches.resize(2 * (usize)variable_count);
+  s->values.assign(variable_count, value_unassigned);
+  s->levels.assign(variable_count, 0);
+  s->reasons.assign(variable_count, no_reason);
+  s->saved_phases.assign(variable_count, true);
+  s->propagation_head = 0;
+
+  s->activities.assign(variable_count, 0.0);
+  s->activity_increment = 1.0;
+  s->heap_positions.assign(variable_count, -1);
+  for (u32 var = 0; var < variable_count; ++var) heap_insert(s, var);
+
+  s->seen.assign(variable_count, 0);
+  s->level_stamps.assign((usize)variable_count + 1, 0);
+  s->stamp = 0;
+}
+
+SolveResult::Enum search(Solver *s) {
+  if (propagate(s) != no_reason) return SolveResult::Unsatisfiable;
+
+  for (u64 restart = 0;; ++restart) {
+    u64 conflict_budget = luby(restart) * restart_unit;
+    u64 conflicts       = 0;
+    for (;;) {
+      ClauseRef conflict = propagate(s);
+      if (conflict != no_reason) {
+        if (decision_level(s) == 0) return SolveResult::Unsatisfiable;
+        ++conflicts;
+
+        u32 backtrack_level;
+        u32 lbd;
+        analyze(s, conflict, &backtrack_level, &lbd);
+        backtrack(s, backtrack_level);
+        if (s->learnt_clause.size() == 1) {
+          enqueue(s, s->learnt_clause[0], no_reason);
+        } else {
+          ClauseRef cref = allocate_clause(s, s->learnt_clause.data(), (u32)s->learnt_clause.size(), true, lbd);
+          s->learnts.push_back(cref);
+          attach_clause(s, cref);
+          enqueue(s, s->learnt_clause[0], cref);
+        }
+        s->activity_increment /= activity_decay;
+        continue;
+      }
+
+      if (conflicts >= conflict_budget) break;
+
+      Lit decision = pick_branch_literal(s);
+      if (decision == no_lit) return SolveResult::Satisfiable;
+      s->trail_limits.push_back(s->trail.size());
+      enqueue(s, decision, no_reason);
+    }
+
+    backtrack(s, 0);
+    if (s->learnts.size() >= s->max_learnts) {
+      reduce_clauses(s);
+      s->max_learnts += s->max_learnts / 10;
+    }
+  }
+}
+
+SolveResult::Enum solve(const ClauseDatabase &cnf, std::vector<bool> *out_model) {
+  Solver solver;
+  Solver *s = &solver;
+  init_solver(s, (u32)cnf.max_variable);
+  s->max_learnts = std::max(cnf.clause_count() / 3, (usize)2000);
+
+  std::vector<Lit> lits;
+  for (usize i = 0; i < cnf.clause_count(); ++i) {
+    if (add_input_clause(s, cnf.clause(i), lits)) return SolveResult::Unsatisfiable;
+  }
+
+  SolveResult::Enum result = search(s);
+  if (result == SolveResult::Satisfiable) {
+    out_model->assign((usize)cnf.max_variable + 1, false);
+    for (u32 var = 0; var < s->variable_count; ++var) (*out_model)[var + 1] = s->values[var] == value_true;
+  }
+  return result;
+}
+
+} // namespace slang
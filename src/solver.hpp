@@ -0,0 +1,24 @@
+#ifndef SOLVER_HPP
+#define SOLVER_HPP
+
+#include "clause_database.hpp"
+#include "general.hpp"
+#include <vector>
+
+namespace slang {
+
+// clang-format off
+#define SOLVE_RESULT(pick) \
+  pick(Satisfiable,   "SATISFIABLE"), \
+  pick(Unsatisfiable, "UNSATISFIABLE"),
+DECLARE_KIND(SOLVE_RESULT, SolveResult);
+// clang-format on
+
+// Decides the clauses of cnf with conflict driven clause learning: two watched literal propagation, EVSIDS branching
+// with phase saving, Luby restarts and LBD based reduction of the learned clauses. When satisfiable, out_model is
+// resized to cnf.max_variable + 1 and (*out_model)[v] holds the value of variable v, index 0 is unused.
+SolveResult::Enum solve(const ClauseDatabase &cnf, std::vector<bool> *out_model);
+
+} // namespace slang
+
+#endif
@@ -0,0 +1,79 @@
+#include "stats.hpp"
+
+#include <chrono>
+#include <sys/resource.h>
+
+namespace slang {
+
+u64 now_ns() {
+  auto since_epoch = std::chrono::steady_clock::now().time_since_epoch();
+  return (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(since_epoch).count();
+}
+
+// VmHWM only counts this process, ru_maxrss also counts what the process that exec'd it had resident before
+u64 peak_rss_kib() {
+  if (FILE *status = fopen("/proc/self/status", "r")) {
+    char line[256];
+    unsigned long long kib = 0;
+    bool found             = false;
+    while (!found && fgets(line, sizeof(line), status)) found = sscanf(line, "VmHWM: %llu kB", &kib) == 1;
+    fclose(status);
+    if (found) return (u64)kib;
+  }
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage)) return 0;
+  return (u64)usage.ru_maxrss;
+}
+
+struct Counter {
+  cstr name;
+  u64 Stats::*value;
+};
+
+const Counter counters[] = {
+    {"source_bytes", &Stats::source_bytes},
+    {"tokens", &Stats::tokens},
+    {"basic_blocks", &Stats::basic_blocks},
+    {"reachable_blocks", &Stats::reachable_blocks},
+    {"sat_nodes", &Stats::sat_nodes},
+    {"table_hits", &Stats::table_hits},
+    {"table_misses", &Stats::table_misses},
+    {"grid_variables", &Stats::grid_variables},
+    {"auxiliary_variables", &Stats::auxiliary_variables},
+    {"clauses", &Stats::clauses},
+    {"duplicate_clauses", &Stats::duplicate_clauses},
+    {"tautologies", &Stats::tautologies},
+    {"cached_blocks", &Stats::cached_blocks},
+    {"compiled_blocks", &Stats::compiled_blocks},
+    {"peak_rss_kib", &Stats::peak_rss_kib},
+};
+
+void print_stats(const Stats &stats, StatsFormat::Enum format, FILE *out) {
+  u64 total_ns = 0;
+  for (u64 ns : stats.phase_ns) total_ns += ns;
+
+  if (format == StatsFormat::Json) {
+    fprintf(out, "{\"phase_ns\": {");
+    for (i32 i = 0; i < Phase::NumItems; ++i) {
+      fprintf(out, "\"%s\": %llu, ", Phase::to_string[i], (unsigned long long)stats.phase_ns[i]);
+    }
+    fprintf(out, "\"total\": %llu}", (unsigned long long)total_ns);
+    for (const Counter &counter : counters) {
+      fprintf(out, ", \"%s\": %llu", counter.name, (unsigned long long)(stats.*counter.value));
+    }
+    fprintf(out, "}\n");
+    return;
+  }
+
+  fprintf(out, "phase                      ns        %%\n");
+  for (i32 i = 0; i < Phase::NumItems; ++i) {
+    double share = total_ns ? 100.0 * (double)stats.phase_ns[i] / (double)total_ns : 0.0;
+    fprintf(out, "%-16s %14llu %7.2f\n", Phase::to_string[i], (unsigned long long)stats.phase_ns[i], share);
+  }
+  fprintf(out, "%-16s %14llu\n\n", "total", (unsigned long long)total_ns);
+  for (const Counter &counter : counters) {
+    fprintf(out, "%-20s %10llu\n", counter.name, (unsigned long long)(stats.*counter.value));
+  }
+}
+
+} // namespace slang
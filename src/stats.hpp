@@ -0,0 +1,63 @@
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#include "general.hpp"
+
+namespace slang {
+
+// clang-format off
+#define PHASE(pick) \
+  pick(Read,         "read"), \
+  pick(Parse,        "parse"), \
+  pick(Cfg,          "cfg"), \
+  pick(GenerateSat,  "generate_sat"), \
+  pick(Dump,         "dump"), \
+  pick(ToCnf,        "to_cnf"), \
+  pick(Preprocess,   "preprocess"), \
+  pick(Solve,        "solve"), \
+  pick(OutputDimacs, "output_dimacs"),
+DECLARE_KIND(PHASE, Phase);
+
+#define STATS_FORMAT(pick) \
+  pick(Human, "human"), \
+  pick(Json,  "json"),
+DECLARE_KIND(STATS_FORMAT, StatsFormat);
+// clang-format on
+
+// What one compilation spent and produced. Phases that did not run stay at 0 ns. Dump is the time spent printing the
+// CFG and the SAT expression to stdout, and when clauses are written while they are generated, to_cnf includes
+// formatting them and output_dimacs only covers opening the file and writing the header.
+struct Stats {
+  u64 phase_ns[Phase::NumItems] = {};
+
+  u64 source_bytes        = 0;
+  u64 tokens              = 0;
+  u64 basic_blocks        = 0; // as parsed
+  u64 reachable_blocks    = 0; // left after optimize_cfg
+  u64 sat_nodes           = 0;
+  u64 table_hits          = 0; // lookups in the expression table that found an existing node, with more than one
+  u64 table_misses        = 0; // thread the lookups of the worker overlays and of importing their nodes both count
+  u64 grid_variables      = 0;
+  u64 auxiliary_variables = 0;
+  u64 clauses             = 0;
+  u64 duplicate_clauses   = 0;
+  u64 tautologies         = 0;
+  u64 cached_blocks       = 0; // clause blocks of constraints --cache found
+  u64 compiled_blocks     = 0; // and the ones it had to compile
+  u64 peak_rss_kib        = 0;
+};
+
+// Monotonic clock for phase timings
+u64 now_ns();
+
+// Adds the time since start_ns to phase
+inline void end_phase(Stats *stats, Phase::Enum phase, u64 start_ns) { stats->phase_ns[phase] += now_ns() - start_ns; }
+
+// High water mark of the resident set of this process
+u64 peak_rss_kib();
+
+void print_stats(const Stats &stats, StatsFormat::Enum format, FILE *out);
+
+} // namespace slang
+
+#endif
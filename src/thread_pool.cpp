@@ -0,0 +1,96 @@
+#include "thread_pool.hpp"
+
+namespace slang {
+
+ThreadPool::ThreadPool(i32 thread_count) {
+  if (thread_count < 1) thread_count = 1;
+  for (i32 i = 0; i < thread_count; ++i) queues.push_back(std::make_unique<TaskQueue>());
+  for (i32 worker = 1; worker < thread_count; ++worker) threads.emplace_back(&ThreadPool::worker_loop, this, worker);
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  batch_started.notify_all();
+  for (std::thread &thread : threads) thread.join();
+}
+
+bool ThreadPool::next_task(i32 worker, i32 *out_task) {
+  TaskQueue &own = *queues[(u32)worker];
+  {
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if (!own.tasks.empty()) {
+      *out_task = own.tasks.front();
+      own.tasks.pop_front();
+      return true;
+    }
+  }
+  // steal from the other end so the victim keeps working through the tasks next to each other
+  for (u32 k = 1; k < queues.size(); ++k) {
+    TaskQueue &victim = *queues[((u32)worker + k) % queues.size()];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.tasks.empty()) {
+      *out_task = victim.tasks.back();
+      victim.tasks.pop_back();
+      return true;
+    }
+  }
+  return false;
+}
+
+void ThreadPool::work(i32 worker) {
+  // tasks are only handed out at the start of a batch, so once every queue is empty nothing new can show up
+  for (i32 task; next_task(worker, &task);) (*current_task)(task, worker);
+}
+
+void ThreadPool::worker_loop(i32 worker) {
+  u64 seen_generation = 0;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      batch_started.wait(lock, [&] { return stopping || generation != seen_generation; });
+      if (stopping) return;
+      seen_generation = generation;
+    }
+    work(worker);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      --busy_workers;
+    }
+    batch_finished.notify_one();
+  }
+}
+
+void ThreadPool::run(i32 task_count, const std::function<void(i32, i32)> &task) {
+  if (task_count <= 0) return;
+  if (threads.empty() || task_count == 1) {
+    for (i32 i = 0; i < task_count; ++i) task(i, 0);
+    return;
+  }
+
+  u32 worker_count = (u32)queues.size();
+  for (u32 worker = 0; worker < worker_count; ++worker) {
+    i32 first = (i32)((u64)task_count * worker / worker_count);
+    i32 last  = (i32)((u64)task_count * (worker + 1) / worker_count);
+    std::lock_guard<std::mutex> lock(queues[worker]->mutex);
+    for (i32 i = first; i < last; ++i) queues[worker]->tasks.push_back(i);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    current_task = &task;
+    busy_workers = (i32)threads.size();
+    ++generation;
+  }
+  batch_started.notify_all();
+
+  work(0);
+
+  std::unique_lock<std::mutex> lock(mutex);
+  batch_finished.wait(lock, [&] { return busy_workers == 0; });
+  current_task = nullptr;
+}
+
+} // namespace slang
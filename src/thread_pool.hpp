@@ -0,0 +1,56 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include "general.hpp"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace slang {
+
+// Fixed set of worker threads that run batches of independent tasks. The calling thread takes part as worker 0.
+// Every worker starts with a contiguous block of the tasks in its own queue and takes them from the front, a worker
+// whose queue is empty steals from the back of the others, so uneven tasks still keep every thread busy.
+class ThreadPool {
+public:
+  explicit ThreadPool(i32 thread_count);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  i32 thread_count() const { return (i32)queues.size(); }
+
+  // Calls task(index, worker) for every index in [0, task_count) and returns when all of them are done. worker is in
+  // [0, thread_count()) and no two tasks run on the same worker at the same time.
+  void run(i32 task_count, const std::function<void(i32, i32)> &task);
+
+private:
+  struct TaskQueue {
+    std::mutex mutex;
+    std::deque<i32> tasks;
+  };
+
+  bool next_task(i32 worker, i32 *out_task);
+  void work(i32 worker);
+  void worker_loop(i32 worker);
+
+  std::vector<std::unique_ptr<TaskQueue>> queues;
+  std::vector<std::thread> threads;
+
+  std::mutex mutex;
+  std::condition_variable batch_started;
+  std::condition_variable batch_finished;
+  const std::function<void(i32, i32)> *current_task = nullptr;
+  u64 generation                                     = 0;
+  i32 busy_workers                                   = 0;
+  bool stopping                                      = false;
+};
+
+} // namespace slang
+
+#endif
@@ -1,184 +1,554 @@
 #include "tseitin_transform.hpp"
 
+#include "cardinality.hpp"
+#include "clause_dedup.hpp"
 #include "sat_syntax_tree.hpp"
-#include <fstream>
-#include <iostream>
-#include <set>
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <memory>
+#include <mutex>
 #include <vector>
-// take arbitrary formula of AND, NOT, OR, and literals, and convert to CNF form using Tseitin transformation
+// take arbitrary formula of AND, NOT, OR, XOR, XNOR, ATMOST, and literals, and convert to CNF form using Tseitin transformation
 
 namespace slang {
 
-// function takes (expression, unordered_map of SAT_Expression to int (int is the new proposition we add), set of all
-// int props ) this function's job is to simply recurse and populate expressionMap, it's simple to construct CNF from
-//  expressionMap and expression, do that with outer function
-// If expressionmap is empty that means its just a literal, so that's in CNF already
-// returns the proposition we map this expression to.
-int convert_to_prop(SAT_Expression *expression, std::unordered_map<SAT_Expression, int> &expressionMap,
-                    //    std::unordered_map<int, SAT_Expression> &newExpressions,
-                    int &nextUnusedProp) {
-  if (expression == nullptr) {
-    return -1;
-  } else if (expression->isLiteral()) {
-    return expression->literal;
-  } else {
-    int leftProp  = convert_to_prop(expression->leftChild, expressionMap, nextUnusedProp);
-    int rightProp = convert_to_prop(expression->rightChild, expressionMap, nextUnusedProp);
-    // now expressionMap should have mappings for our left and right
-
-    // mutate expression:
-    if (leftProp != -1) {
-      expression->leftChild = new SAT_Expression(leftProp);
-    }
-    expression->rightChild = new SAT_Expression(rightProp);
-
-    auto it = expressionMap.find(*expression);
-    if (it != expressionMap.end()) {
-      // already have a mapping
-      int value = it->second;
-      return value;
+// Collects every non-literal node reachable from expression in post-order, left child first, and returns the largest
+// literal found along the way. The walk keeps its own stack of pending nodes instead of recursing, so left-deep
+// chains from loop unrolling can be arbitrarily long, and the expression itself is never modified. visited is
+// indexed by node id so a node shared by several parents is only collected once. The LIST nodes holding the operands
+// of an ATMOST are walked but are not definitions of their own.
+int collect_definitions(const SAT_Expression *expression, std::vector<bool> &visited,
+                        std::vector<const SAT_Expression *> &definitions) {
+  int maxLiteral = 0;
+  auto isPending = [&visited, &maxLiteral](const SAT_Expression *child) {
+    if (!child) return false;
+    if (child->isLiteral()) {
+      maxLiteral = std::max(maxLiteral, child->literal);
+      return false;
+    }
+    return !visited[static_cast<std::size_t>(child->id)];
+  };
+
+  // A node is only ever pushed by its parent while the parent is on top, and the DAG is acyclic, so no node can
+  // be on the stack twice and the stack never grows beyond the depth of the formula
+  std::vector<const SAT_Expression *> stack;
+  stack.push_back(expression);
+  while (!stack.empty()) {
+    const SAT_Expression *top = stack.back();
+    if (isPending(top->leftChild)) {
+      stack.push_back(top->leftChild);
+    } else if (isPending(top->rightChild)) {
+      stack.push_back(top->rightChild);
     } else {
-      expressionMap[*expression] = nextUnusedProp;
-      int ret                    = nextUnusedProp++;
-      return ret;
-    }
-  }
-}
-
-std::set<int> set_of_props(SAT_Expression *expression) {
-  std::set<int> props;
-  if (expression == nullptr) {
-    return props;
-  } else if (expression->isLiteral()) {
-    props.insert(expression->literal);
-    return props;
-  } else {
-    std::set<int> leftProps  = set_of_props(expression->leftChild);
-    std::set<int> rightProps = set_of_props(expression->rightChild);
-    props.insert(leftProps.begin(), leftProps.end());
-    props.insert(rightProps.begin(), rightProps.end());
-    return props;
-  }
-}
-
-// Function that takes a SAT_Expression and the int representing the proposition we mapped it to and returns a vector of
-// vector of ints for the clauses
-//  that represent the CNF form of the expression
-std::vector<std::vector<int>> clauses_representing_biconditional_mapping(const SAT_Expression *expression, int prop) {
-  std::vector<std::vector<int>> clauses;
-  switch (expression->op) {
-  case Operator::AND: {
-    // (prop <-> a ^ b) = (-a v -b v prop) ^ (a v -prop) ^ (b v -prop)
-    std::vector<int> clause1;
-    clause1.push_back(prop);
-    clause1.push_back(-expression->leftChild->literal);
-    clause1.push_back(-expression->rightChild->literal);
-    clauses.push_back(clause1);
-
-    std::vector<int> clause2;
-    clause2.push_back(-prop);
-    clause2.push_back(expression->leftChild->literal);
-    clauses.push_back(clause2);
-
-    std::vector<int> clause3;
-    clause3.push_back(-prop);
-    clause3.push_back(expression->rightChild->literal);
-    clauses.push_back(clause3);
+      stack.pop_back();
+      if (!visited[static_cast<std::size_t>(top->id)]) {
+        visited[static_cast<std::size_t>(top->id)] = true;
+        if (top->op != Operator::LIST) definitions.push_back(top);
+      }
+    }
+  }
+  return maxLiteral;
+}
+
+bool is_parity(Operator op) { return op == Operator::XOR || op == Operator::XNOR; }
+
+// An AND or OR node that is only used by a parent with the same operator is merged into that parent, so chains
+// such as the ones loop unrolling builds become a single n-ary definition. XOR and XNOR nodes merge into each other
+// since an XNOR is an XOR with the result negated. Shared nodes are kept separate since merging them would duplicate
+// their operands into every parent.
+std::vector<bool> find_absorbed(const SAT_ExpressionTable &table,
+                                const std::vector<const SAT_Expression *> &definitions) {
+  std::vector<uint8_t> parentCount(static_cast<std::size_t>(table.size()), 0);
+  auto countParent = [&parentCount](const SAT_Expression *child) {
+    if (child && !child->isLiteral()) {
+      uint8_t &count = parentCount[static_cast<std::size_t>(child->id)];
+      if (count < 2) ++count;
+    }
+  };
+  for (const SAT_Expression *definition : definitions) {
+    if (definition->op == Operator::ATMOST) {
+      for (const SAT_Expression *list = definition->rightChild; list; list = list->rightChild) {
+        countParent(list->leftChild);
+      }
+      continue;
+    }
+    countParent(definition->leftChild);
+    countParent(definition->rightChild);
+  }
+
+  std::vector<bool> absorbed(static_cast<std::size_t>(table.size()), false);
+  for (const SAT_Expression *definition : definitions) {
+    bool parity = is_parity(definition->op);
+    if (definition->op != Operator::AND && definition->op != Operator::OR && !parity) continue;
+    for (const SAT_Expression *child : {definition->leftChild, definition->rightChild}) {
+      bool merges = parity ? is_parity(child->op) : child->op == definition->op;
+      if (merges && parentCount[static_cast<std::size_t>(child->id)] == 1) {
+        absorbed[static_cast<std::size_t>(child->id)] = true;
+      }
+    }
+  }
+  return absorbed;
+}
+
+// A definition after flattening: prop <-> op(operands[firstOperand .. firstOperand + operandCount)). AND, OR and
+// ATMOST have any number of operands, NOT has exactly one. ATMOST also has its bound and the auxiliary variables of
+// its encoding, which are numbered after the props of all definitions. XNOR is flattened into an inverted XOR of at
+// most xor_chunk_size operands.
+struct FlatDefinition {
+  Operator op;
+  int prop;
+  std::size_t firstOperand;
+  std::size_t operandCount;
+  int bound;
+  int firstAuxiliary;
+  bool inverted;
+};
+
+// An XOR of n operands takes 2^(n+1) clauses, so longer chains are cut into chunks that each carry the XOR of the
+// chunks before them as their first operand. Three operands need the fewest clauses plus props per operand.
+const std::size_t xor_chunk_size = 3;
+
+// Gathers the props under an XOR or XNOR definition and its absorbed descendants into leaves and returns whether the
+// result is negated. An operand that occurs twice cancels out.
+bool collect_parity_leaves(const SAT_Expression *definition, const std::vector<bool> &absorbed,
+                           const std::vector<int> &propOfNode, std::vector<const SAT_Expression *> &stack,
+                           std::vector<int> &leaves) {
+  bool inverted = definition->op == Operator::XNOR;
+  leaves.clear();
+  stack.push_back(definition->rightChild);
+  stack.push_back(definition->leftChild);
+  while (!stack.empty()) {
+    const SAT_Expression *operand = stack.back();
+    stack.pop_back();
+    if (operand->isLiteral()) {
+      leaves.push_back(operand->literal);
+    } else if (absorbed[static_cast<std::size_t>(operand->id)]) {
+      inverted = inverted != (operand->op == Operator::XNOR);
+      stack.push_back(operand->rightChild);
+      stack.push_back(operand->leftChild);
+    } else {
+      leaves.push_back(propOfNode[static_cast<std::size_t>(operand->id)]);
+    }
+  }
+
+  std::sort(leaves.begin(), leaves.end());
+  std::size_t kept = 0;
+  for (std::size_t k = 0; k < leaves.size(); ++k) {
+    if (k + 1 < leaves.size() && leaves[k] == leaves[k + 1]) {
+      ++k;
+    } else {
+      leaves[kept++] = leaves[k];
+    }
+  }
+  leaves.resize(kept);
+  return inverted;
+}
+
+// Assigns props to the definitions that were not absorbed, in post-order starting at firstProp, and gathers the
+// props of their operands. Props are stored by node id in propOfNode, the operands of a merged chain are found by
+// descending through absorbed nodes left to right.
+void flatten(const std::vector<const SAT_Expression *> &definitions, const std::vector<bool> &absorbed, int firstProp,
+             std::vector<int> &propOfNode, std::vector<FlatDefinition> &flatDefinitions, std::vector<int> &operands) {
+  auto propOf = [&propOfNode](const SAT_Expression *expression) {
+    return expression->isLiteral() ? expression->literal : propOfNode[static_cast<std::size_t>(expression->id)];
+  };
+
+  int nextUnusedProp = firstProp;
+  std::vector<const SAT_Expression *> stack;
+  std::vector<int> leaves;
+  for (const SAT_Expression *definition : definitions) {
+    if (absorbed[static_cast<std::size_t>(definition->id)]) continue;
+
+    FlatDefinition flatDefinition;
+    flatDefinition.op           = definition->op;
+    flatDefinition.firstOperand = operands.size();
+    flatDefinition.bound        = definition->literal;
+    flatDefinition.inverted     = false;
+    if (is_parity(definition->op)) {
+      // the chunks get their props before the definition, which stays last and is the only one that is inverted
+      bool inverted    = collect_parity_leaves(definition, absorbed, propOfNode, stack, leaves);
+      int carried      = 0;
+      std::size_t next = 0;
+      while (leaves.size() - next + (carried ? 1 : 0) > xor_chunk_size) {
+        FlatDefinition chunk = flatDefinition;
+        chunk.op             = Operator::XOR;
+        chunk.prop           = nextUnusedProp++;
+        chunk.firstOperand   = operands.size();
+        chunk.operandCount   = xor_chunk_size;
+        if (carried) operands.push_back(carried);
+        while (operands.size() - chunk.firstOperand < xor_chunk_size) operands.push_back(leaves[next++]);
+        flatDefinitions.push_back(chunk);
+        carried = chunk.prop;
+      }
+      flatDefinition.op           = Operator::XOR;
+      flatDefinition.inverted     = inverted;
+      flatDefinition.firstOperand = operands.size();
+      if (carried) operands.push_back(carried);
+      operands.insert(operands.end(), leaves.begin() + static_cast<std::ptrdiff_t>(next), leaves.end());
+    } else if (definition->op == Operator::NOT) {
+      operands.push_back(propOf(definition->rightChild));
+    } else if (definition->op == Operator::ATMOST) {
+      for (const SAT_Expression *list = definition->rightChild; list; list = list->rightChild) {
+        operands.push_back(propOf(list->leftChild));
+      }
+    } else {
+      stack.push_back(definition->rightChild);
+      stack.push_back(definition->leftChild);
+      while (!stack.empty()) {
+        const SAT_Expression *operand = stack.back();
+        stack.pop_back();
+        if (!operand->isLiteral() && absorbed[static_cast<std::size_t>(operand->id)]) {
+          stack.push_back(operand->rightChild);
+          stack.push_back(operand->leftChild);
+        } else {
+          operands.push_back(propOf(operand));
+        }
+      }
+    }
+    flatDefinition.operandCount = operands.size() - flatDefinition.firstOperand;
+    flatDefinition.prop         = nextUnusedProp++;
+
+    propOfNode[static_cast<std::size_t>(definition->id)] = flatDefinition.prop;
+    flatDefinitions.push_back(flatDefinition);
+  }
+}
+
+// Which sides of a definition are needed: a node that only occurs positively only has to imply its definition, a
+// node that only occurs negatively only has to be implied by it
+enum Polarity : uint8_t { Positive = 1, Negative = 2, Both = Positive | Negative };
+
+Polarity flip(Polarity polarity) {
+  return static_cast<Polarity>(((polarity & Positive) ? Negative : 0) | ((polarity & Negative) ? Positive : 0));
+}
+
+// Pushes the polarity of every definition down to its operands. Definitions are in post-order with consecutive props
+// so walking them backwards visits every parent before its children, and the definition of an operand prop is at
+// index prop - firstProp. The last definition is the overall formula which is asserted, so it is only positive.
+// More true operands can only make an ATMOST false, so like NOT it passes the opposite polarity to its operands.
+// Flipping any operand of an XOR flips its value, so its operands occur with both polarities.
+std::vector<uint8_t> compute_polarities(const std::vector<FlatDefinition> &flatDefinitions,
+                                        const std::vector<int> &operands, int firstProp) {
+  std::vector<uint8_t> polarities(flatDefinitions.size(), 0);
+  polarities.back() = Positive;
+  for (std::size_t i = flatDefinitions.size(); i-- > 0;) {
+    const FlatDefinition &definition = flatDefinitions[i];
+    Polarity polarity                = static_cast<Polarity>(polarities[i]);
+    bool flips                       = definition.op == Operator::NOT || definition.op == Operator::ATMOST;
+    Polarity operandPolarity         = flips ? flip(polarity) : polarity;
+    if (definition.op == Operator::XOR) operandPolarity = Both;
+    for (std::size_t k = 0; k < definition.operandCount; ++k) {
+      int operand = operands[definition.firstOperand + k];
+      if (operand >= firstProp) polarities[static_cast<std::size_t>(operand - firstProp)] |= operandPolarity;
+    }
+  }
+  return polarities;
+}
+
+// An ATMOST with bound k of n operands is (-prop v at most k operands) ^ (prop v at most n-k-1 negated operands),
+// each half in the encoding that is cheapest for its bound
+int cardinality_auxiliaries(const FlatDefinition &definition, Polarity polarity) {
+  int count       = static_cast<int>(definition.operandCount);
+  int auxiliaries = 0;
+  if (polarity & Positive) auxiliaries += choose_at_most_encoding(count, definition.bound).auxiliary_variables;
+  if (polarity & Negative) {
+    auxiliaries += choose_at_most_encoding(count, count - definition.bound - 1).auxiliary_variables;
+  }
+  return auxiliaries;
+}
+
+// Gives the ATMOST definitions their auxiliary variables after the props of all definitions and returns the first
+// prop that is still unused. The numbers only depend on the definitions, so every run of definitions knows them
+int number_auxiliaries(std::vector<FlatDefinition> &flatDefinitions, const std::vector<uint8_t> &polarities,
+                       int firstProp) {
+  int nextUnusedProp = firstProp + static_cast<int>(flatDefinitions.size());
+  for (std::size_t i = 0; i < flatDefinitions.size(); ++i) {
+    FlatDefinition &definition = flatDefinitions[i];
+    if (definition.op != Operator::ATMOST) continue;
+    definition.firstAuxiliary = nextUnusedProp;
+    nextUnusedProp += cardinality_auxiliaries(definition, polarities.empty() ? Both : Polarity(polarities[i]));
+  }
+  return nextUnusedProp;
+}
+
+// Function that takes a flattened definition and the propositions of its operands and passes the clauses that
+// represent the CNF form of the expression to cnf. With both polarities this is the full biconditional, otherwise only
+// the implication that polarity needs. An n-ary AND/OR costs k+1 clauses instead of 3 per binary node of the chain
+void clauses_representing_mapping(const FlatDefinition &definition, const int *operands, Polarity polarity,
+                                  std::vector<int> &clause, std::vector<int> &negated, ClauseSink *cnf) {
+  int prop = definition.prop;
+  switch (definition.op) {
+  case Operator::AND:
+    // (prop <-> a ^ b ^ ...) = (-a v -b v ... v prop) ^ (a v -prop) ^ (b v -prop) ^ ...
+    if (polarity & Negative) {
+      clause.clear();
+      clause.push_back(prop);
+      for (std::size_t k = 0; k < definition.operandCount; ++k) clause.push_back(-operands[k]);
+      cnf->add_clause(clause.data(), clause.size());
+    }
+    if (polarity & Positive) {
+      for (std::size_t k = 0; k < definition.operandCount; ++k) cnf->add_clause({-prop, operands[k]});
+    }
     break;
-  } // end case AND
-  case Operator::OR: {
-    // (prop <-> a v b) = (a v b v -prop) ^ (-a v prop) ^ (-b v prop)
-    std::vector<int> clause1;
-    clause1.push_back(-prop);
-    clause1.push_back(expression->leftChild->literal);
-    clause1.push_back(expression->rightChild->literal);
-    clauses.push_back(clause1);
-
-    std::vector<int> clause2;
-    clause2.push_back(prop);
-    clause2.push_back(-expression->leftChild->literal);
-    clauses.push_back(clause2);
-
-    std::vector<int> clause3;
-    clause3.push_back(prop);
-    clause3.push_back(-expression->rightChild->literal);
-    clauses.push_back(clause3);
+  case Operator::OR:
+    // (prop <-> a v b v ...) = (a v b v ... v -prop) ^ (-a v prop) ^ (-b v prop) ^ ...
+    if (polarity & Positive) {
+      clause.clear();
+      clause.push_back(-prop);
+      for (std::size_t k = 0; k < definition.operandCount; ++k) clause.push_back(operands[k]);
+      cnf->add_clause(clause.data(), clause.size());
+    }
+    if (polarity & Negative) {
+      for (std::size_t k = 0; k < definition.operandCount; ++k) cnf->add_clause({prop, -operands[k]});
+    }
     break;
-  } // end case OR
-  case Operator::NOT: {
+  case Operator::NOT:
     // (prop <-> -b) = (prop v b) ^ (-prop v -b)
-    std::vector<int> clause1;
-    clause1.push_back(prop);
-    clause1.push_back(expression->rightChild->literal);
-    clauses.push_back(clause1);
-    std::vector<int> clause2;
-    clause2.push_back(-prop);
-    clause2.push_back(-expression->rightChild->literal);
-    clauses.push_back(clause2);
+    if (polarity & Negative) cnf->add_clause({prop, operands[0]});
+    if (polarity & Positive) cnf->add_clause({-prop, -operands[0]});
+    break;
+  case Operator::ATMOST: {
+    int count         = static_cast<int>(definition.operandCount);
+    int nextAuxiliary = definition.firstAuxiliary;
+    if (polarity & Positive) {
+      AtMostEncoding encoding = choose_at_most_encoding(count, definition.bound);
+      emit_at_most(operands, count, definition.bound, -prop, nextAuxiliary, encoding, clause, cnf);
+      nextAuxiliary += encoding.auxiliary_variables;
+    }
+    if (polarity & Negative) {
+      negated.clear();
+      for (int k = 0; k < count; ++k) negated.push_back(-operands[k]);
+      int bound               = count - definition.bound - 1;
+      AtMostEncoding encoding = choose_at_most_encoding(count, bound);
+      emit_at_most(negated.data(), count, bound, prop, nextAuxiliary, encoding, clause, cnf);
+    }
+    break;
+  }
+  case Operator::XOR: {
+    // every assignment of the operands gets the clause that rules out the wrong value of prop, the ones with -prop
+    // make up prop -> XOR and the ones with prop XOR -> prop. Two operands take the usual 4 clauses.
+    std::size_t count = definition.operandCount;
+    for (uint32_t assignment = 0; assignment < (uint32_t(1) << count); ++assignment) {
+      bool odd = (__builtin_parity(assignment) != 0) != definition.inverted;
+      if (!(polarity & (odd ? Negative : Positive))) continue;
+      clause.clear();
+      for (std::size_t k = 0; k < count; ++k) clause.push_back((assignment >> k) & 1 ? -operands[k] : operands[k]);
+      clause.push_back(odd ? prop : -prop);
+      cnf->add_clause(clause.data(), clause.size());
+    }
     break;
-  } // end case NOT
+  }
   default: assert(!"Unreachable"); break;
   }
-  return clauses;
 }
 
-// list of clauses, where each clause is a list of ints OR'd together
-std::vector<std::vector<int>> to_cnf(SAT_Expression *expression) {
-  std::vector<std::vector<int>> cnf;
-  std::set<int> all_props = set_of_props(expression);
-  // get max of set_of_props
-  int lastUsedProp   = *all_props.rbegin();
-  int nextUnusedProp = lastUsedProp + 1;
-  std::unordered_map<SAT_Expression, int> expressionMap;
-  int overall_prop = convert_to_prop(expression, expressionMap, nextUnusedProp);
-  // add overall_prop to cnf
-  std::vector<int> overall_prop_clause;
-  overall_prop_clause.push_back(overall_prop);
-  cnf.push_back(overall_prop_clause);
-
-  // iterate over all expressions in expressionMap and add the clauses they generate to cnf
-  for (auto &x : expressionMap) {
-    std::vector<std::vector<int>> clauses = clauses_representing_biconditional_mapping(&x.first, x.second);
-    cnf.insert(cnf.end(), clauses.begin(), clauses.end());
+// Emits the clauses of flatDefinitions[first .. last) to cnf in order
+void emit_definitions(const std::vector<FlatDefinition> &flatDefinitions, const std::vector<int> &operands,
+                      const std::vector<uint8_t> &polarities, std::size_t first, std::size_t last, ClauseSink *cnf) {
+  std::vector<int> clause, negated;
+  for (std::size_t i = first; i < last; ++i) {
+    Polarity polarity = polarities.empty() ? Both : static_cast<Polarity>(polarities[i]);
+    clauses_representing_mapping(flatDefinitions[i], &operands[flatDefinitions[i].firstOperand], polarity, clause,
+                                 negated, cnf);
   }
-  return cnf;
 }
 
-// Helper function to calculate the number of variables
-int getNumberOfVariables(const std::vector<std::vector<int>> &cnf) {
-  int maxVariable = 0;
+// Definitions are split into runs of about run_literals literals of clauses. The pool works through them in windows
+// of runs_per_thread runs per thread, so stealing can even out uneven runs, and every run of a window emits into a
+// buffer of its own that the same run of the next window reuses. At most one window of clauses is buffered at once
+// however large the formula is, and the runs are passed on in run order, which gives exactly the clause order of the
+// serial loop.
+const std::size_t runs_per_thread = 8;
+const u64 run_literals            = 1 << 16;
 
-  for (const auto &clause : cnf) {
-    for (const auto &literal : clause) {
-      int variable = std::abs(literal);
-      assert(variable != 0); // 0 is not a valid variable
-      maxVariable = std::max(maxVariable, variable);
+// Roughly how many literals the clauses of a definition have. A binomial ATMOST has long clauses, the clauses of
+// the other encodings have at most three literals.
+u64 estimated_literals(const FlatDefinition &definition, Polarity polarity) {
+  u64 count = definition.operandCount;
+  switch (definition.op) {
+  case Operator::AND:
+  case Operator::OR: return 3 * count + 1;
+  case Operator::NOT: return 4;
+  case Operator::XOR: return (count + 1) << (count + 1);
+  case Operator::ATMOST: {
+    u64 literals = 0;
+    for (int bound : {definition.bound, static_cast<int>(count) - definition.bound - 1}) {
+      if (!(polarity & (bound == definition.bound ? Positive : Negative))) continue;
+      AtMostEncoding encoding = choose_at_most_encoding(static_cast<int>(count), bound);
+      literals += encoding.clauses * (encoding.encoding == CardinalityEncoding::Binomial ? u64(bound) + 2 : 3);
     }
+    return literals;
   }
+  default: return count;
+  }
+}
 
-  return maxVariable;
+std::vector<std::size_t> split_runs(const std::vector<FlatDefinition> &flatDefinitions,
+                                    const std::vector<uint8_t> &polarities) {
+  std::vector<std::size_t> runStarts{0};
+  u64 literalsInRun = 0;
+  for (std::size_t i = 0; i < flatDefinitions.size(); ++i) {
+    literalsInRun += estimated_literals(flatDefinitions[i], polarities.empty() ? Both : Polarity(polarities[i]));
+    if (literalsInRun >= run_literals && i + 1 < flatDefinitions.size()) {
+      runStarts.push_back(i + 1);
+      literalsInRun = 0;
+    }
+  }
+  runStarts.push_back(flatDefinitions.size());
+  return runStarts;
 }
 
-void output_dimacs(const std::vector<std::vector<int>> &cnf, std::string filename) {
-  std::ofstream outFile(filename);
+// Appends the runs to cnf. A prefix sum over the run sizes gives every run its place in the literal and offset
+// arrays, so the runs are copied in parallel
+void append_runs(const ClauseDatabase *runs, std::size_t runCount, ClauseDatabase *cnf, ThreadPool *pool) {
+  std::vector<std::size_t> literalStarts(runCount + 1, cnf->literals.size());
+  std::vector<std::size_t> clauseStarts(runCount + 1, cnf->clause_count());
+  for (std::size_t r = 0; r < runCount; ++r) {
+    literalStarts[r + 1] = literalStarts[r] + runs[r].literals.size();
+    clauseStarts[r + 1]  = clauseStarts[r] + runs[r].clause_count();
+    cnf->max_variable    = std::max(cnf->max_variable, runs[r].max_variable);
+  }
+  cnf->literals.resize(literalStarts.back());
+  cnf->offsets.resize(clauseStarts.back() + 1);
+
+  pool->run(static_cast<i32>(runCount), [&](i32 run, i32) {
+    std::size_t r              = static_cast<std::size_t>(run);
+    const ClauseDatabase &part = runs[r];
+    std::copy(part.literals.begin(), part.literals.end(),
+              cnf->literals.begin() + static_cast<std::ptrdiff_t>(literalStarts[r]));
+    for (std::size_t k = 1; k <= part.clause_count(); ++k) {
+      cnf->offsets[clauseStarts[r] + k] = literalStarts[r] + part.offsets[k];
+    }
+  });
+}
 
-  if (!outFile) {
-    std::cerr << "Error: Could not open file for writing: " << filename << std::endl;
+// Emits the definitions on the pool. A database gets every window appended with append_runs once it is done. Any
+// other sink gets a run as soon as it and every run before it are done: the worker that finishes a run passes on the
+// runs that are ready unless another worker already does, so the sink only ever sees one thread at a time.
+void emit_definitions_parallel(const std::vector<FlatDefinition> &flatDefinitions, const std::vector<int> &operands,
+                               const std::vector<uint8_t> &polarities, const std::vector<std::size_t> &runStarts,
+                               ThreadPool *pool, ClauseSink *cnf, ClauseDatabase *database) {
+  std::size_t runCount   = runStarts.size() - 1;
+  std::size_t windowSize = static_cast<std::size_t>(pool->thread_count()) * runs_per_thread;
+  std::vector<ClauseDatabase> buffers(std::min(windowSize, runCount));
+
+  std::mutex mutex;
+  std::vector<bool> done;
+  std::size_t nextToPass = 0;
+  bool isPassing         = false;
+  for (std::size_t first = 0; first < runCount; first += windowSize) {
+    std::size_t count = std::min(windowSize, runCount - first);
+    for (std::size_t b = 0; b < count; ++b) buffers[b].clear();
+    done.assign(count, false);
+    nextToPass = 0;
+
+    pool->run(static_cast<i32>(count), [&](i32 task, i32) {
+      std::size_t b = static_cast<std::size_t>(task);
+      emit_definitions(flatDefinitions, operands, polarities, runStarts[first + b], runStarts[first + b + 1],
+                       &buffers[b]);
+      if (database) return;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        done[b] = true;
+        if (isPassing) return;
+        isPassing = true;
+      }
+      for (;;) {
+        std::size_t ready;
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          if (nextToPass == count || !done[nextToPass]) {
+            isPassing = false;
+            return;
+          }
+          ready = nextToPass++;
+        }
+        for (std::size_t i = 0; i < buffers[ready].clause_count(); ++i) {
+          Clause clause = buffers[ready].clause(i);
+          cnf->add_clause(clause.begin(), clause.size());
+        }
+      }
+    });
+    if (database) append_runs(buffers.data(), count, database, pool);
+  }
+}
+
+// list of clauses, where each clause is a list of ints OR'd together. Clauses are handed to the sink as soon as they
+// are generated so nothing beyond the flattened definitions is kept around. With more than one thread the clauses
+// of a run of definitions are buffered until the runs before it have been handed over.
+void emit_cnf(const SAT_ExpressionTable &table, const SAT_Expression *expression, ClauseSink *cnf,
+              const CnfOptions &options, CnfStats *out_stats, ClauseDatabase *database) {
+  // If there are no definitions that means its just a literal, so that's in CNF already
+  if (expression->isLiteral()) {
+    cnf->add_clause({expression->literal});
     return;
   }
 
-  // Write the DIMACS header
-  outFile << "p cnf " << getNumberOfVariables(cnf) << " " << cnf.size() << std::endl;
+  std::vector<bool> visited(static_cast<std::size_t>(table.size()), false);
+  std::vector<const SAT_Expression *> definitions;
+  int lastUsedProp = collect_definitions(expression, visited, definitions);
+  int firstProp    = lastUsedProp + 1;
 
-  // Write each clause to the file
-  for (const auto &clause : cnf) {
-    for (const auto &literal : clause) {
-      outFile << literal << " ";
-    }
-    outFile << "0\n"; // Terminate the clause with '0'
+  std::vector<bool> absorbed = find_absorbed(table, definitions);
+  std::vector<int> propOfNode(static_cast<std::size_t>(table.size()), 0);
+  std::vector<FlatDefinition> flatDefinitions;
+  std::vector<int> operands;
+  flatten(definitions, absorbed, firstProp, propOfNode, flatDefinitions, operands);
+
+  // Plain Tseitin treats every node as occurring with both polarities
+  std::vector<uint8_t> polarities;
+  if (options.encoding == CnfEncoding::PlaistedGreenbaum) {
+    polarities = compute_polarities(flatDefinitions, operands, firstProp);
+  }
+  int nextUnusedProp = number_auxiliaries(flatDefinitions, polarities, firstProp);
+  if (out_stats) out_stats->auxiliary_variables += static_cast<u64>(nextUnusedProp - firstProp);
+
+  // add overall_prop to cnf, the overall formula is always the last definition
+  cnf->add_clause({flatDefinitions.back().prop});
+
+  // iterate over all defined expressions and add the clauses they generate to cnf, a formula that makes a single run
+  // is not worth the threads
+  i32 threadCount = options.pool ? options.pool->thread_count() : options.thread_count;
+  std::vector<std::size_t> runStarts;
+  if (threadCount > 1) runStarts = split_runs(flatDefinitions, polarities);
+  if (runStarts.size() < 3) {
+    emit_definitions(flatDefinitions, operands, polarities, 0, flatDefinitions.size(), cnf);
+    return;
   }
 
-  outFile.close();
+  std::unique_ptr<ThreadPool> ownPool;
+  ThreadPool *pool = options.pool;
+  if (!pool) {
+    ownPool.reset(new ThreadPool(threadCount));
+    pool = ownPool.get();
+  }
+  emit_definitions_parallel(flatDefinitions, operands, polarities, runStarts, pool, cnf, database);
+}
+
+// Deduplication has to see the clauses in order, so with it the runs are handed over one clause at a time
+void to_cnf(const SAT_ExpressionTable &table, const SAT_Expression *expression, ClauseSink *cnf,
+            const CnfOptions &options, CnfStats *out_stats, ClauseDatabase *database) {
+  if (!options.deduplicate) {
+    emit_cnf(table, expression, cnf, options, out_stats, database);
+    return;
+  }
+  DeduplicatingSink deduplicated(cnf);
+  emit_cnf(table, expression, &deduplicated, options, out_stats, nullptr);
+  if (out_stats) {
+    out_stats->duplicate_clauses += deduplicated.duplicate_count;
+    out_stats->tautologies += deduplicated.tautology_count;
+  }
+}
+
+void to_cnf(const SAT_ExpressionTable &table, const SAT_Expression *expression, ClauseSink *cnf,
+            const CnfOptions &options, CnfStats *out_stats) {
+  to_cnf(table, expression, cnf, options, out_stats, nullptr);
+}
+
+ClauseDatabase to_cnf(const SAT_ExpressionTable &table, const SAT_Expression *expression,
+                      const CnfOptions &options, CnfStats *out_stats) {
+  ClauseDatabase cnf;
+  to_cnf(table, expression, &cnf, options, out_stats, &cnf);
+  return cnf;
 }
 
 } // namespace slang
@@ -1,14 +1,45 @@
 #ifndef TSEITIN_TRANSFORM_HPP
 #define TSEITIN_TRANSFORM_HPP
 
+#include "clause_database.hpp"
+#include "general.hpp"
 #include "sat_syntax_tree.hpp"
-#include <vector>
 
 namespace slang {
 
-std::vector<std::vector<int>> to_cnf(SAT_Expression *expression);
+class ThreadPool;
 
-void output_dimacs(const std::vector<std::vector<int>> &cnf, std::string filename);
+// clang-format off
+#define CNF_ENCODING(pick) \
+  pick(Tseitin,           "tseitin"), \
+  pick(PlaistedGreenbaum, "pg"),
+DECLARE_KIND(CNF_ENCODING, CnfEncoding);
+// clang-format on
+
+struct CnfOptions {
+  // Plaisted-Greenbaum only emits the half of every definition that the polarity of the node requires. The result
+  // is equisatisfiable but no longer forces auxiliary variables to match their subformula
+  CnfEncoding::Enum encoding = CnfEncoding::Tseitin;
+  // Definitions are emitted on this many threads, the clauses come out in the same order for every thread count
+  i32 thread_count = 1;
+  // Pool of thread_count threads to emit on, shared with generate_sat. Without one every call starts its own.
+  ThreadPool *pool = nullptr;
+  // Every clause is emitted once with its literals sorted, tautologies are left out. This keeps a copy of every
+  // clause, so the CNF is no longer streamed in bounded memory
+  bool deduplicate = false;
+};
+
+struct CnfStats {
+  u64 duplicate_clauses   = 0;
+  u64 tautologies         = 0;
+  u64 auxiliary_variables = 0; // props defined for the operator nodes of the expression and cardinality encodings
+};
+
+void to_cnf(const SAT_ExpressionTable &table, const SAT_Expression *expression, ClauseSink *cnf,
+            const CnfOptions &options = {}, CnfStats *out_stats = nullptr);
+
+ClauseDatabase to_cnf(const SAT_ExpressionTable &table, const SAT_Expression *expression,
+                      const CnfOptions &options = {}, CnfStats *out_stats = nullptr);
 
 } // namespace slang
 
@@ -0,0 +1,25 @@
+// Converts a CNF between DIMACS and the binary container of binary_cnf.hpp. The direction follows from the input:
+// a binary CNF is written out as DIMACS and anything else is read as DIMACS and written as a binary CNF.
+//
+// usage: cnf-convert <input> <output>
+
+#include "general.hpp"
+
+#include "binary_cnf.hpp"
+#include "dimacs.hpp"
+
+int main(int argc, char **argv) {
+  if (argc != 3) {
+    error("usage: cnf-convert <input> <output>\n");
+    return err;
+  }
+
+  slang::ClauseDatabase cnf;
+  if (slang::is_binary_cnf(argv[1])) {
+    slang::BinaryCnf binary;
+    if (binary.open(argv[1]) || binary.load(&cnf)) return err;
+    return slang::output_dimacs(cnf, argv[2]);
+  }
+  if (slang::read_dimacs(argv[1], &cnf)) return err;
+  return slang::output_binary_cnf(cnf, argv[2]);
+}